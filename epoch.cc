@@ -0,0 +1,130 @@
+/*	--*- c++ -*--
+ * Copyright (C) 2014 Enrico Scholz <ensc@ensc.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 and/or 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "epoch.h"
+
+#include <sched.h>
+#include <string.h>
+
+#include "util.h"
+
+EpochDomain::EpochDomain() :
+	epoch_(1), retired_(NULL), num_retired_(0)
+{
+	memset(readers_, 0, sizeof readers_);
+}
+
+EpochDomain::~EpochDomain()
+{
+	// no readers are expected anymore
+	while (retired_) {
+		EpochObject	*obj = retired_;
+
+		retired_ = obj->retire_next_;
+		delete obj;
+	}
+}
+
+unsigned int EpochDomain::enter(void)
+{
+	unsigned long	epoch = __atomic_load_n(&epoch_, __ATOMIC_SEQ_CST);
+
+	for (;;) {
+		for (size_t i = 0; i < ARRAY_SIZE(readers_); ++i) {
+			unsigned long	unused = 0;
+
+			if (__atomic_compare_exchange_n(&readers_[i], &unused,
+							(epoch << 1) | 1,
+							false,
+							__ATOMIC_SEQ_CST,
+							__ATOMIC_RELAXED))
+				return i;
+		}
+
+		// all slots are in use; this is not expected with the number
+		// of threads used by the plugin
+		sched_yield();
+	}
+}
+
+void EpochDomain::leave(unsigned int slot)
+{
+	__atomic_store_n(&readers_[slot], 0, __ATOMIC_RELEASE);
+}
+
+void EpochDomain::retire(EpochObject *obj)
+{
+	if (!obj)
+		return;
+
+	retired_lock_.Lock();
+	obj->retire_epoch_ = __atomic_fetch_add(&epoch_, 1, __ATOMIC_SEQ_CST);
+	obj->retire_next_  = retired_;
+	retired_           = obj;
+	__atomic_fetch_add(&num_retired_, 1, __ATOMIC_RELAXED);
+	retired_lock_.Unlock();
+}
+
+void EpochDomain::reclaim(void)
+{
+	unsigned long	min_epoch = ~0ul;
+	EpochObject	*pending = NULL;
+	EpochObject	*freeable = NULL;
+	unsigned int	num_pending = 0;
+	EpochObject	*obj;
+
+	// fast path; nothing has been retired
+	if (__atomic_load_n(&num_retired_, __ATOMIC_RELAXED) == 0)
+		return;
+
+	retired_lock_.Lock();
+
+	for (size_t i = 0; i < ARRAY_SIZE(readers_); ++i) {
+		unsigned long	v = __atomic_load_n(&readers_[i],
+						    __ATOMIC_SEQ_CST);
+
+		if (v != 0 && (v >> 1) < min_epoch)
+			min_epoch = v >> 1;
+	}
+
+	obj = retired_;
+	while (obj) {
+		EpochObject	*next = obj->retire_next_;
+
+		if (obj->retire_epoch_ < min_epoch) {
+			obj->retire_next_ = freeable;
+			freeable = obj;
+		} else {
+			obj->retire_next_ = pending;
+			pending = obj;
+			++num_pending;
+		}
+
+		obj = next;
+	}
+
+	retired_ = pending;
+	__atomic_store_n(&num_retired_, num_pending, __ATOMIC_RELAXED);
+	retired_lock_.Unlock();
+
+	// destructors might retire further objects; call them without
+	// holding the lock
+	while (freeable) {
+		obj      = freeable;
+		freeable = obj->retire_next_;
+		delete obj;
+	}
+}
@@ -0,0 +1,88 @@
+/*	--*- c++ -*--
+ * Copyright (C) 2014 Enrico Scholz <ensc@ensc.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 and/or 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_VDR_INPUTDEV_EPOCH_H
+#define H_ENSC_VDR_INPUTDEV_EPOCH_H
+
+#include <vdr/thread.h>
+
+class EpochDomain;
+
+// Base class of objects which are freed by EpochDomain::reclaim()
+class EpochObject {
+public:
+	EpochObject() : retire_epoch_(0), retire_next_(0) {}
+	virtual ~EpochObject() {}
+
+private:
+	friend class EpochDomain;
+
+	unsigned long	retire_epoch_;
+	EpochObject	*retire_next_;
+};
+
+// Epoch based reclamation.  Readers access shared objects only between
+// enter() and leave(); objects which have been unpublished are passed to
+// retire() and freed by reclaim() when no reader which might still see
+// them is active anymore.
+class EpochDomain {
+public:
+	EpochDomain();
+	~EpochDomain();
+
+	unsigned int	enter(void);
+	void		leave(unsigned int slot);
+
+	void		retire(EpochObject *obj);
+	void		reclaim(void);
+
+	unsigned int	get_num_retired(void) const {
+		return __atomic_load_n(&num_retired_, __ATOMIC_RELAXED);
+	}
+
+private:
+	enum { MAX_READERS = 32 };
+
+	// (epoch << 1) | 1 for active readers, 0 for unused slots
+	unsigned long	readers_[MAX_READERS];
+	unsigned long	epoch_;
+
+	cMutex		retired_lock_;
+	EpochObject	*retired_;
+	unsigned int	num_retired_;
+
+	EpochDomain(EpochDomain const &);
+	EpochDomain &operator = (EpochDomain const &);
+};
+
+class EpochGuard {
+public:
+	explicit EpochGuard(EpochDomain &domain) :
+		domain_(domain), slot_(domain.enter()) {}
+
+	~EpochGuard() {
+		domain_.leave(slot_);
+	}
+
+private:
+	EpochDomain	&domain_;
+	unsigned int	slot_;
+
+	EpochGuard(EpochGuard const &);
+	EpochGuard &operator = (EpochGuard const &);
+};
+
+#endif	/* H_ENSC_VDR_INPUTDEV_EPOCH_H */
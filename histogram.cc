@@ -0,0 +1,89 @@
+/*	--*- c++ -*--
+ * Copyright (C) 2014 Enrico Scholz <ensc@ensc.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 and/or 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "histogram.h"
+
+#include <algorithm>
+#include <string.h>
+
+#include "util.h"
+
+LatencyHistogram::LatencyHistogram() :
+	count_(0), max_(0)
+{
+	memset(buckets_, 0, sizeof buckets_);
+}
+
+unsigned int LatencyHistogram::get_bucket(uint32_t usec)
+{
+	if (usec < 2)
+		return 0;
+
+	return 31 - __builtin_clz(usec);
+}
+
+void LatencyHistogram::add(uint32_t usec)
+{
+	uint32_t	max = __atomic_load_n(&max_, __ATOMIC_RELAXED);
+
+	__atomic_fetch_add(&buckets_[get_bucket(usec)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&count_, 1, __ATOMIC_RELAXED);
+
+	while (usec > max &&
+	       !__atomic_compare_exchange_n(&max_, &max, usec, true,
+					    __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED))
+		;			// noop
+}
+
+uint32_t LatencyHistogram::get_count(void) const
+{
+	return __atomic_load_n(&count_, __ATOMIC_RELAXED);
+}
+
+uint32_t LatencyHistogram::get_max(void) const
+{
+	return __atomic_load_n(&max_, __ATOMIC_RELAXED);
+}
+
+uint32_t LatencyHistogram::get_percentile(unsigned int pct) const
+{
+	uint32_t	buckets[ARRAY_SIZE(buckets_)];
+	uint64_t	total = 0;
+	uint64_t	limit;
+	uint64_t	sum = 0;
+
+	// work on a snapshot; counters might be modified concurrently
+	for (size_t i = 0; i < ARRAY_SIZE(buckets); ++i) {
+		buckets[i] = __atomic_load_n(&buckets_[i], __ATOMIC_RELAXED);
+		total     += buckets[i];
+	}
+
+	if (total == 0)
+		return 0;
+
+	limit = (total * pct + 99) / 100;
+
+	for (size_t i = 0; i < ARRAY_SIZE(buckets); ++i) {
+		uint32_t	bound = (i < 31) ? (2u << i) - 1 : ~0u;
+
+		sum += buckets[i];
+		if (sum >= limit)
+			return std::min(bound, get_max());
+	}
+
+	return get_max();
+}
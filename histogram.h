@@ -0,0 +1,46 @@
+/*	--*- c++ -*--
+ * Copyright (C) 2014 Enrico Scholz <ensc@ensc.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 and/or 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_VDR_INPUTDEV_HISTOGRAM_H
+#define H_ENSC_VDR_INPUTDEV_HISTOGRAM_H
+
+#include <stdint.h>
+
+// Histogram with logarithmic buckets; bucket 'i' counts values in the
+// range [2^i, 2^(i+1)).  Values are updated with relaxed atomic operations
+// and can be read concurrently.
+class LatencyHistogram {
+public:
+	LatencyHistogram();
+
+	void		add(uint32_t usec);
+
+	uint32_t	get_count(void) const;
+	uint32_t	get_max(void) const;
+
+	// returns the upper bound of the bucket which contains the given
+	// percentile (0..100)
+	uint32_t	get_percentile(unsigned int pct) const;
+
+private:
+	uint32_t	buckets_[32];
+	uint32_t	count_;
+	uint32_t	max_;
+
+	static unsigned int	get_bucket(uint32_t usec);
+};
+
+#endif	/* H_ENSC_VDR_INPUTDEV_HISTOGRAM_H */
@@ -23,278 +23,707 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <linux/netlink.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/sysmacros.h>
 #include <linux/input.h>
 
 #include <vdr/plugin.h>
 
+#ifndef EVIOCSCLOCKID
+#  define EVIOCSCLOCKID		_IOW('E', 0xa0, int)
+#endif
+
+#include "histogram.h"
+#include "keyfilter.h"
+#include "keyqueue.h"
 #include "modmap.h"
+#include "profile.h"
+#include "stats.h"
+#include "translation.h"
+#include "uevent.h"
 #include "util.h"
 #include "quirks.h"
+#include "rtsched.h"
+#include "scancodes.h"
+#include "sequence.h"
 
 namespace Time {
-	static int compare(struct timespec const &a,
-			   struct timespec const &b);
-
-	static int compare(struct timeval const &a,
-			   struct timeval const &b);
-
-	static void add(struct timespec &res,
-			struct timespec const &a,
-			struct timespec const &b);
-
-	static void add(struct timeval &res,
-			struct timeval const &a,
-			struct timeval const &b);
-
 	static bool is_null(struct timeval const &a)
 	{
 		return a.tv_sec == 0 && a.tv_usec == 0;
 	}
 
-	static bool check_clock_gettime(void);
+	static int64_t diff_us(struct timespec const &a,
+			       struct timeval const &b)
+	{
+		return ((int64_t)(a.tv_sec) - b.tv_sec) * 1000000 +
+			a.tv_nsec / 1000 - b.tv_usec;
+	}
 };
 
-class MagicState {
+// Generates key repeats for devices with the 'soft_repeat' quirk.  All
+// devices share one timerfd in the epoll set of the controller; it is armed
+// for the earliest pending repeat and disarmed while no key is held.  Like
+// the kernel autorepeat, only the last pressed key of a device repeats.
+//
+// Devices are used only as an identifier and never dereferenced.
+class cInputKeyRepeater : public cEpollHandler {
 private:
-	static bool const	IS_SUPPORTED_;
+	class cHeldKey : public cListObject {
+	public:
+		class cInputDevice const	*dev;
+		struct KeyEvent			key;	// stats are referenced
+		int64_t				due_ns;	// CLOCK_MONOTONIC
+	};
+
+	cInputDeviceController	&controller_;
+	int			fd_;
+	cMutex			lock_;
+	cList<cHeldKey>		keys_;
+	int64_t			armed_ns_;	// 0 when disarmed
 
-	unsigned int		state_;
-	struct timespec		next_;
+	cInputKeyRepeater(cInputKeyRepeater const &);
+	cInputKeyRepeater & operator = (cInputKeyRepeater const &);
 
+	static int64_t	now_ns(void);
+
+	cHeldKey	*find(class cInputDevice const *dev);
+	void		remove(cHeldKey *key);
+	void		rearm(void);
+
+	// these must be called with 'lock_' held
+	void		start_repeat(class cInputDevice const *dev,
+				     struct KeyEvent const &key);
+	void		stop_repeat(class cInputDevice const *dev,
+				    uint16_t type, uint16_t code);
+	void		drop(class cInputDevice const *dev);
 
 public:
-	static struct timespec const	TIMEOUT;
+	enum hold {
+		hoNONE,		// key is not repeated by the plugin
+		hoPRESS,	// repeat 'key' after the repeat delay; replaces
+				// the key which is held on 'dev' currently
+		hoRELEASE,	// stop the repeat when 'key' is the held key
+		hoCANCEL,	// stop the repeat of any key of 'dev'
+	};
+
+	explicit cInputKeyRepeater(cInputDeviceController &controller) :
+		controller_(controller), fd_(-1), armed_ns_(0) {}
+	virtual ~cInputKeyRepeater();
 
-	MagicState() : state_(0) {}
-	bool	process(struct input_event const &ev);
+	bool		open(int efd);
 
+	// queues 'key' and updates the held key of 'dev' while holding the
+	// lock of handle_pollin(); no repeat of a released or replaced key
+	// can be queued after 'key' then.  Returns false when the key queue
+	// is full.
+	bool		queue_key(class cInputDevice const *dev,
+				  struct KeyEvent const &key, enum hold hold);
+	void		cancel(class cInputDevice const *dev);
+
+	virtual void	handle_hup() {}
+	virtual void	handle_pollin();
 };
 
-static bool Time::check_clock_gettime(void)
+cInputKeyRepeater::~cInputKeyRepeater()
 {
-	struct timespec		tmp;
+	while (keys_.First())
+		remove(keys_.First());
 
-	if (clock_gettime(CLOCK_MONOTONIC, &tmp) < 0) {
-		fprintf(stderr,
-			"clock_gettime() not available; magic keysequences will not be available: %s\n",
-			strerror(errno));
+	cInputDeviceController::close(fd_);
+}
+
+int64_t cInputKeyRepeater::now_ns(void)
+{
+	struct timespec	now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ll + now.tv_nsec;
+}
+
+bool cInputKeyRepeater::open(int efd)
+{
+	struct epoll_event	ev = { };
+
+	fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (fd_ < 0)
+		return false;
+
+	ev.events   = EPOLLIN;
+	ev.data.ptr = static_cast<cEpollHandler *>(this);
+
+	if (epoll_ctl(efd, EPOLL_CTL_ADD, fd_, &ev) < 0) {
+		cInputDeviceController::close(fd_);
 		return false;
 	}
 
 	return true;
 }
 
-bool const		MagicState::IS_SUPPORTED_ = Time::check_clock_gettime();
-struct timespec const	MagicState::TIMEOUT = { 2, 500000000 };
-
-int Time::compare(struct timespec const &a, struct timespec const &b)
+cInputKeyRepeater::cHeldKey *cInputKeyRepeater::find(class cInputDevice const *dev)
 {
-	if (a.tv_sec < b.tv_sec)
-		return -1;
-	else if (a.tv_sec > b.tv_sec)
-		return + 1;
-	else if (a.tv_nsec < b.tv_nsec)
-		return -1;
-	else if (a.tv_nsec > b.tv_nsec)
-		return +1;
-	else
-		return 0;
+	for (cHeldKey *i = keys_.First(); i; i = keys_.Next(i)) {
+		if (i->dev == dev)
+			return i;
+	}
+
+	return NULL;
 }
 
-int Time::compare(struct timeval const &a, struct timeval const &b)
+void cInputKeyRepeater::remove(cHeldKey *key)
 {
-	if (a.tv_sec < b.tv_sec)
-		return -1;
-	else if (a.tv_sec > b.tv_sec)
-		return + 1;
-	else if (a.tv_usec < b.tv_usec)
-		return -1;
-	else if (a.tv_usec > b.tv_usec)
-		return +1;
-	else
-		return 0;
+	key->key.stats->unref();
+	keys_.Del(key);
 }
 
-void Time::add(struct timespec &res,
-	       struct timespec const &a, struct timespec const &b)
+void cInputKeyRepeater::rearm(void)
 {
-	assert(a.tv_nsec < 1000000000);
-	assert(b.tv_nsec < 1000000000);
+	struct itimerspec	tm = { };
+	int64_t			due = 0;
+
+	for (cHeldKey *i = keys_.First(); i; i = keys_.Next(i)) {
+		if (due == 0 || i->due_ns < due)
+			due = i->due_ns;
+	}
+
+	if (due == armed_ns_)
+		return;
 
-	res.tv_sec  = a.tv_sec + b.tv_sec;
-	res.tv_nsec = a.tv_nsec + b.tv_nsec;
+	// a zero 'it_value' disarms the timer
+	tm.it_value.tv_sec  = due / 1000000000ll;
+	tm.it_value.tv_nsec = due % 1000000000ll;
 
-	if (res.tv_nsec >= 1000000000) {
-		res.tv_nsec -= 1000000000;
-		res.tv_sec  += 1;
+	if (timerfd_settime(fd_, TFD_TIMER_ABSTIME, &tm, NULL) < 0) {
+		esyslog("%s: failed to arm repeat timer: %s\n",
+			controller_.plugin_name(), strerror(errno));
+		due = 0;
 	}
+
+	armed_ns_ = due;
 }
 
-void Time::add(struct timeval &res,
-	       struct timeval const &a, struct timeval const &b)
+void cInputKeyRepeater::start_repeat(class cInputDevice const *dev,
+				     struct KeyEvent const &key)
 {
-	assert(a.tv_usec < 1000000000);
-	assert(b.tv_usec < 1000000000);
+	cHeldKey	*held;
+	int64_t		base;
 
-	res.tv_sec  = a.tv_sec + b.tv_sec;
-	res.tv_usec = a.tv_usec + b.tv_usec;
+	if (fd_ < 0)
+		return;
+
+	// schedule relative to the kernel timestamp when possible; it is not
+	// affected by the latency of the event loop
+	if (key.clock_id == CLOCK_MONOTONIC)
+		base = (key.ev.time.tv_sec * 1000000ll +
+			key.ev.time.tv_usec) * 1000;
+	else
+		base = now_ns();
 
-	if (res.tv_usec >= 1000000) {
-		res.tv_usec -= 1000000;
-		res.tv_sec  += 1;
+	held = find(dev);
+	if (held) {
+		held->key.stats->unref();
+	} else {
+		held = new cHeldKey();
+		held->dev = dev;
+		keys_.Add(held);
 	}
+
+	held->key    = key;
+	held->key.stats->ref();
+	held->due_ns = base + controller_.get_repeat_delay() * 1000000ll;
+
+	rearm();
 }
 
-bool MagicState::process(struct input_event const &ev)
+void cInputKeyRepeater::stop_repeat(class cInputDevice const *dev,
+				    uint16_t type, uint16_t code)
 {
-	static unsigned int const	SEQUENCE[] = {
-		KEY_LEFTSHIFT,
-		KEY_LEFTSHIFT,
-		KEY_ESC,
-		KEY_LEFTSHIFT,
-	};
+	cHeldKey	*held = find(dev);
 
-	unsigned int		code;
-	struct timespec		now;
+	if (held && held->key.ev.type == type && held->key.ev.code == code) {
+		remove(held);
+		rearm();
+	}
+}
 
-	assert(state_ < ARRAY_SIZE(SEQUENCE));
+bool cInputKeyRepeater::queue_key(class cInputDevice const *dev,
+				  struct KeyEvent const &key, enum hold hold)
+{
+	cMutexLock	lock(&lock_);
+	bool		is_queued = controller_.queue_key(key);
+
+	switch (hold) {
+	case hoPRESS:
+		// do not repeat a key which has not been seen by vdr; it
+		// still stops the repeat of the previous one
+		if (is_queued)
+			start_repeat(dev, key);
+		else
+			drop(dev);
+		break;
 
-	if (!IS_SUPPORTED_)
-		return false;
+	case hoRELEASE:
+		stop_repeat(dev, key.ev.type, key.ev.code);
+		break;
 
-	if (ev.type != EV_KEY || ev.value != 1)
-		// ignore non-key events and skip release- and repeat events
-		return false;
+	case hoCANCEL:
+		drop(dev);
+		break;
 
-	// translate some keys
-	switch (ev.code) {
-	case KEY_RIGHTSHIFT:	code = KEY_LEFTSHIFT; break;
-	default:		code = ev.code;
+	case hoNONE:
+		break;
 	}
 
-	clock_gettime(CLOCK_MONOTONIC, &now);
-	if (state_ > 0 && Time::compare(next_, now) < 0)
-		// reset state due to timeout
-		state_ = 0;
+	return is_queued;
+}
 
-	if (SEQUENCE[state_] != code) {
-		state_ = 0;
-	} else {
-		++state_;
-		Time::add(next_, now, TIMEOUT);
+void cInputKeyRepeater::drop(class cInputDevice const *dev)
+{
+	cHeldKey	*held = find(dev);
+
+	if (held) {
+		remove(held);
+		rearm();
 	}
+}
 
-	if (state_ == ARRAY_SIZE(SEQUENCE)) {
-		state_ = 0;
-		return true;
+void cInputKeyRepeater::cancel(class cInputDevice const *dev)
+{
+	cMutexLock	lock(&lock_);
+
+	drop(dev);
+}
+
+void cInputKeyRepeater::handle_pollin(void)
+{
+	cMutexLock	lock(&lock_);
+	uint64_t	cnt;
+	ssize_t		rc;
+	int64_t		now = now_ns();
+	int64_t		rate = controller_.get_repeat_rate() * 1000000ll;
+
+	rc = read(fd_, &cnt, sizeof cnt);
+	(void)rc;
+
+	// the timer fired and must be armed again
+	armed_ns_ = 0;
+
+	if (rate <= 0)
+		rate = 1000000;
+
+	for (cHeldKey *i = keys_.First(); i; i = keys_.Next(i)) {
+		struct KeyEvent		key;
+		struct timespec		tm;
+
+		if (i->due_ns > now)
+			continue;
+
+		// emit only one repeat when the loop was stalled; a burst of
+		// delayed repeats would overshoot
+		while (i->due_ns <= now)
+			i->due_ns += rate;
+
+		clock_gettime(i->key.clock_id, &tm);
+
+		key                  = i->key;
+		key.ev.time.tv_sec   = tm.tv_sec;
+		key.ev.time.tv_usec  = tm.tv_nsec / 1000;
+		key.ev.value         = 2;
+		key.is_repeated      = true;
+		key.stats->ref();
+
+		if (!controller_.queue_key(key)) {
+			dsyslog("%s: key queue overflow; dropping repeat\n",
+				controller_.plugin_name());
+			key.stats->unref();
+		}
 	}
 
-	return false;
+	rearm();
 }
 
-class cInputDevice : public cListObject, public cEpollHandler {
+// ===========================
+
+class cInputDevice : public EpochObject, public cEpollHandler {
 private:
 	cInputDeviceController	&controller_;
 	cString			dev_path_;
 	cString			description_;
 	int			fd_;
 	dev_t			dev_t_;
-	class MagicState	magic_state_;
-	class Quirks		quirks_;
+
+	// progress of the hotkey sequences; 'has_hotkeys_' is false when
+	// the device can not produce any of them
+	SequenceMatcher::State	hotkey_state_;
+	bool			has_hotkeys_;
+
+	// probed properties and quirks; restored from the profile cache when
+	// the device is known already
+	struct DeviceProfile	profile_;
+	bool			is_known_;
 
 	unsigned long		modifiers_;
-	unsigned int		orig_rate_[2];
+	enum ModifierMap::keytable	keytable_;
+	// assigned modmap; NULL when using the default one
+	class SharedModmap	*modmap_;
+
+	// translation table of the current event batch; the event loop
+	// guarantees that it stays valid until the batch has been handled
+	TranslationTable const	*translation_;
+
+	TranslationTable const	*get_translation(void) const;
 
 	struct timeval		repeat_rate_;
-	unsigned int		last_key_val_;
-	struct timeval		next_key_tm_;
+
+	// per-key policies; drops duplicate and unwanted repeats
+	KeyFilter		key_filter_;
+
+	// events of the current, not yet terminated SYN_REPORT frame
+	struct input_event	frame_[32];
+	size_t			frame_len_;
+	bool			syn_dropped_;
+
+	unsigned long		key_state_[BITS_TO_LONGS(KEY_CNT)];
+
+	// relative axes (wheels, dials) which are translated into keys; the
+	// motion of a SYN frame is accumulated and one key is sent for every
+	// 'rel_threshold_' units
+	enum rel_axis {
+		relWHEEL,
+		relHWHEEL,
+		relDIAL,
+
+		_relMAX
+	};
+
+	int			rel_delta_[_relMAX];
+	int			rel_pos_[_relMAX];
+	unsigned int		rel_threshold_[_relMAX];
+	struct timeval		rel_time_[_relMAX];
+	struct timeval		rel_frame_time_;
+	bool			has_rel_motion_;
+
+	// absolute axes (sticks, d-pads) which are translated into
+	// directional keys; see flush_abs()
+	enum abs_axis {
+		absX,
+		absY,
+		absHAT0X,
+		absHAT0Y,
+
+		_absMAX
+	};
+
+	struct abs_state {
+		bool		is_valid;	// axis reported by EVIOCGABS
+		int		center;
+		int		half_range;
+		// thresholds in per mille of 'half_range'
+		int		press_thresh;
+		int		release_thresh;
+
+		int		value;		// last reported value
+		int		dir;		// -1, 0 or +1
+	};
+
+	struct abs_state	abs_[_absMAX];
+	struct timeval		abs_frame_time_;
+	bool			has_abs_motion_;
+
+	clockid_t		clock_id_;
+	class DeviceStats	*stats_;
+
+	// event loop which handles the device; NULL for the main loop of the
+	// controller
+	class cInputEventLoop	*loop_;
+
+	// chains of cInputDeviceIndex
+	class cInputDevice	*next_by_rdev_;
+	class cInputDevice	*next_by_path_;
+	uint32_t		path_hash_;
+
+	friend class cInputDeviceIndex;
 
 	cInputDevice(cInputDevice const &);
 	cInputDevice & operator	= (cInputDevice const &);
 
 	bool			has_orig_repeate_rate(void) const {
-		return orig_rate_[0] != 0 && orig_rate_[1] != 0;
+		return profile_.orig_rate[0] != 0 && profile_.orig_rate[1] != 0;
 	}
 
+	bool			handle_event(struct input_event const &ev);
+	bool			handle_hotkey(enum SequenceMatcher::action act);
+	void			toggle_capslock(void);
+	bool			update_key_bits(void);
+	void			handle_rel(struct input_event const &ev);
+	void			flush_rel(void);
+	void			probe_abs(void);
+	void			handle_abs(struct input_event const &ev);
+	void			flush_abs(void);
+	void			send_abs_key(enum abs_axis axis, int dir,
+					     bool is_released);
+	void			submit_key(struct KeyEvent &key,
+					   enum cInputKeyRepeater::hold hold =
+					   cInputKeyRepeater::hoNONE);
+	bool			queue_event(struct input_event const &ev);
+	bool			flush_frame(void);
+	bool			sync_state(struct timeval const &tm);
+
 public:
-	// the vdr list implementation requires knowledge about the containing
-	// list when unlinking a object :(
-	cList<cInputDevice>	*container;
+	// link in the device list of the controller; readers walk it under an
+	// EpochGuard, writers hold 'dev_mutex_'
+	class cInputDevice	*next_device;
+
+	// set by remove_device(); protected by 'dev_mutex_'
+	bool			is_removed;
 
 	cInputDevice(cInputDeviceController &controller,
 		     cString const &dev_path);
 	virtual ~cInputDevice();
 
-	virtual int Compare(cListObject const &b) const {
-		return Compare(dynamic_cast<cInputDevice const &>(b));
-	}
-
-	virtual int Compare(cInputDevice const &b) const {
-		return this->dev_t_ - b.dev_t_;
-	}
-
-	virtual int Compare(dev_t b) const {
-		return this->dev_t_ - b;
-	}
-
 	virtual void	handle_hup();
 	virtual void	handle_pollin();
 
 	bool		open(void);
-	bool		start(int efd);
+	bool		start(void);
+	bool		attach(int efd);
 	void		stop(int efd);
+	void		release(void);
 	int		get_fd(void) const { return fd_; }
+
+	void		set_loop(class cInputEventLoop *loop) { loop_ = loop; }
+	class cInputEventLoop	*get_loop(void) const { return loop_; }
 	char const	*get_description(void) const { return description_; }
 	char const	*get_dev_path(void) const { return dev_path_; }
+	dev_t		get_dev_t(void) const { return dev_t_; }
 
 	bool		set_repeat_rate(unsigned int delay_ms,
 					unsigned int rate_ms);
 
+	// returns the old modmap which must be released by the caller
+	class SharedModmap	*set_modmap(class SharedModmap *modmap);
+
 	void		dump(void) const;
+	cString		format_stats(int64_t now_us) const;
 	void		change_quirk(char const *quirk, bool do_set);
+	void		change_key_policy(char const *spec);
+	void		change_rel_threshold(char const *spec);
 
 	static uint64_t	generate_code(uint16_t type, uint16_t code,
 				      uint32_t value);
 	static void	install_keymap(char const *remote);
 
+	static enum eKeys const	*get_key_table(void) { return key_table_; }
+
+private:
+	// direct translation of EV_KEY codes into vdr keys; filled by
+	// install_keymap()
+	static enum eKeys	key_table_[KEY_CNT];
+
 };
 
 cInputDevice::cInputDevice(cInputDeviceController &controller,
 			   cString const &dev_path) :
 	controller_(controller), dev_path_(dev_path), fd_(-1), dev_t_(0),
-	modifiers_(0), container(NULL)
+	has_hotkeys_(false),
+	is_known_(false),
+	modifiers_(0), keytable_(ModifierMap::ktNORMAL),
+	modmap_(NULL), translation_(controller.get_translation()),
+	frame_len_(0), syn_dropped_(false), has_rel_motion_(false),
+	has_abs_motion_(false),
+	clock_id_(CLOCK_REALTIME),
+	stats_(new DeviceStats()), loop_(NULL),
+	next_by_rdev_(NULL), next_by_path_(NULL),
+	path_hash_(fnv1a_hash(dev_path)), next_device(NULL), is_removed(false)
 {
-	orig_rate_[0] = 0;
-	orig_rate_[1] = 0;
+	memset(key_state_, 0, sizeof key_state_);
+	memset(rel_delta_, 0, sizeof rel_delta_);
+	memset(rel_pos_, 0, sizeof rel_pos_);
+	memset(rel_time_, 0, sizeof rel_time_);
+	memset(abs_, 0, sizeof abs_);
+
+	rel_threshold_[relWHEEL]  = 1;
+	rel_threshold_[relHWHEEL] = 1;
+	rel_threshold_[relDIAL]   = 2;
 }
 
 cInputDevice::~cInputDevice()
 {
+	// the event loop might have pressed a key after remove_device()
+	// canceled the repeat
+	controller_.get_repeater().cancel(this);
 	controller_.close(fd_);
+	controller_.put_modmap(modmap_);
+	stats_->unref();
+}
+
+TranslationTable const *cInputDevice::get_translation(void) const
+{
+	SharedModmap const	*modmap = __atomic_load_n(&modmap_,
+							  __ATOMIC_ACQUIRE);
+	TranslationTable const	*res = modmap ? modmap->get_table() : NULL;
+
+	// fall back to the default table while the modmap is being loaded
+	return res ? res : controller_.get_translation();
+}
+
+class SharedModmap *cInputDevice::set_modmap(class SharedModmap *modmap)
+{
+	return __atomic_exchange_n(&modmap_, modmap, __ATOMIC_ACQ_REL);
 }
 
 void cInputDevice::dump(void) const
 {
+	LatencyHistogram const	&latency = stats_->latency;
+
 	dsyslog("%s:   %lx %s (%s), fd=%d\n", controller_.plugin_name(),
 		static_cast<unsigned long>(dev_t_),
 		get_dev_path(), get_description(), get_fd());
+	dsyslog("%s:     profile %s, quirks %s\n", controller_.plugin_name(),
+		*profile_.key, profile_.quirks.to_string().c_str());
+	dsyslog("%s:     latency: %u keys, p50 <= %uus, p99 <= %uus, max %uus\n",
+		controller_.plugin_name(), latency.get_count(),
+		latency.get_percentile(50), latency.get_percentile(99),
+		latency.get_max());
+}
+
+cString cInputDevice::format_stats(int64_t now_us) const
+{
+	DeviceStats const	&st = *stats_;
+	int64_t			last = st.get_last_event();
+	cString			age;
+
+	if (last == 0)
+		age = "-";
+	else
+		age = cString::sprintf("%" PRId64 "ms", (now_us - last) / 1000);
+
+	return cString::sprintf("%s events=%lu bytes=%lu keys=%lu suppressed=%lu "
+				"put_failed=%lu syn_dropped=%lu coalesced=%lu age=%s "
+				"latency_p99=%uus (%s)",
+				get_dev_path(),
+				st.get(DeviceStats::cntEVENTS),
+				st.get(DeviceStats::cntBYTES),
+				st.get(DeviceStats::cntKEYS),
+				st.get(DeviceStats::cntSUPPRESSED),
+				st.get(DeviceStats::cntPUT_FAILED),
+				st.get(DeviceStats::cntSYN_DROPPED),
+				st.get(DeviceStats::cntCOALESCED),
+				*age, st.latency.get_percentile(99),
+				get_description());
 }
 
 void cInputDevice::change_quirk(char const *quirk, bool do_set)
 {
 	try {
-		quirks_.change(quirk, do_set);
+		profile_.quirks.change(quirk, do_set);
 		dsyslog("%s: %s %s quirk '%s'\n", controller_.plugin_name(),
 			get_dev_path(),
 			do_set ? "enabled" : "disabled",
 			quirk);
+
+		if (strcasecmp(quirk, "soft_repeat") == 0) {
+			controller_.get_repeater().cancel(this);
+			set_repeat_rate(controller_.get_repeat_delay(),
+					controller_.get_repeat_rate());
+		}
+
+		// keep the quirk over reconnects
+		controller_.get_profiles().store(profile_);
 	} catch (Quirks::UnknownQuirkError const &e) {
 		esyslog("%s: %s %s\n", controller_.plugin_name(),
 			get_dev_path(), e.what());
 	}
 }
 
+static struct {
+	uint16_t	code;
+	char const	*name;
+	enum eKeys	key_pos;
+	enum eKeys	key_neg;
+} const		REL_AXES[] = {
+	{ REL_WHEEL,  "wheel",  kUp,      kDown },
+	{ REL_HWHEEL, "hwheel", kFastFwd, kFastRew },
+	{ REL_DIAL,   "dial",   kVolUp,   kVolDn },
+};
+
+static struct {
+	uint16_t	code;
+	enum eKeys	key_neg;
+	enum eKeys	key_pos;
+} const		ABS_AXES[] = {
+	{ ABS_X,     kLeft, kRight },
+	{ ABS_Y,     kUp,   kDown },
+	{ ABS_HAT0X, kLeft, kRight },
+	{ ABS_HAT0Y, kUp,   kDown },
+};
+
+void cInputDevice::change_rel_threshold(char const *spec)
+{
+	char const	*sep = strchr(spec, '=');
+	unsigned long	v;
+	char		*end;
+
+	for (size_t i = 0; sep && i < ARRAY_SIZE(REL_AXES); ++i) {
+		if (strncasecmp(spec, REL_AXES[i].name, sep - spec) != 0 ||
+		    REL_AXES[i].name[sep - spec] != '\0')
+			continue;
+
+		errno = 0;
+		v = strtoul(sep + 1, &end, 10);
+		if (errno != 0 || end == sep + 1 || *end != '\0' ||
+		    v == 0 || v > 10000)
+			break;
+
+		__atomic_store_n(&rel_threshold_[i], v, __ATOMIC_RELAXED);
+		dsyslog("%s: %s set %s threshold to %lu\n",
+			controller_.plugin_name(), get_dev_path(),
+			REL_AXES[i].name, v);
+		return;
+	}
+
+	esyslog("%s: %s invalid threshold '%s'\n",
+		controller_.plugin_name(), get_dev_path(), spec);
+}
+
+void cInputDevice::change_key_policy(char const *spec)
+{
+	char const	*sep = strchr(spec, '=');
+	char		name[32];
+	uint16_t	policy;
+	int		code;
+
+	if (!sep || (size_t)(sep - spec) >= sizeof name) {
+		esyslog("%s: %s invalid key policy '%s'\n",
+			controller_.plugin_name(), get_dev_path(), spec);
+		return;
+	}
+
+	memcpy(name, spec, sep - spec);
+	name[sep - spec] = '\0';
+
+	code = ModifierMap::find_keycode(name);
+	if (code < 0) {
+		esyslog("%s: %s unknown key '%s'\n",
+			controller_.plugin_name(), get_dev_path(), name);
+		return;
+	}
+
+	if (!KeyFilter::parse_policy(sep + 1, policy)) {
+		esyslog("%s: %s invalid policy '%s' for key '%s'\n",
+			controller_.plugin_name(), get_dev_path(), sep + 1,
+			name);
+		return;
+	}
+
+	key_filter_.set_policy(code, policy);
+	dsyslog("%s: %s set policy of key %d to '%s'\n",
+		controller_.plugin_name(), get_dev_path(), code, sep + 1);
+}
+
 uint64_t cInputDevice::generate_code(uint16_t type, uint16_t code,
 				     uint32_t value)
 {
@@ -308,6 +737,8 @@ uint64_t cInputDevice::generate_code(uint16_t type, uint16_t code,
 	return res;
 }
 
+enum eKeys	cInputDevice::key_table_[KEY_CNT];
+
 void cInputDevice::install_keymap(char const *remote)
 {
 	static struct {
@@ -374,12 +805,24 @@ void cInputDevice::install_keymap(char const *remote)
 
 	size_t		i;
 
+	for (i = 0; i < ARRAY_SIZE(key_table_); ++i)
+		key_table_[i] = kNone;
+
 	for (i = 0; i < ARRAY_SIZE(MAPPING); ++i) {
 		uint64_t	code = generate_code(0, EV_KEY, MAPPING[i].code);
 		char		buf[17];
+		enum eKeys	key;
 
 		snprintf(buf, sizeof buf, "%016"PRIX64, code);
-		Keys.Add(new cKey(remote, buf, MAPPING[i].vdr_key));
+
+		// honor mappings from remote.conf
+		key = Keys.Get(remote, buf);
+		if (key == kNone) {
+			key = MAPPING[i].vdr_key;
+			Keys.Add(new cKey(remote, buf, key));
+		}
+
+		key_table_[MAPPING[i].code] = key;
 	}
 }
 
@@ -387,14 +830,14 @@ bool cInputDevice::open(void)
 {
 	char const	*path = dev_path_;
 	char		description[256];
+	char		uniq[64] = "";
+	char		phys[64] = "";
 	int		fd;
 	int		rc;
 	struct stat	st;
-	unsigned long	events_mask[(std::max(EV_CNT,KEY_MAX) +
-				     sizeof(unsigned long) * 8 - 1)/
-				    (sizeof(unsigned long) * 8)];
+	struct input_id	id;
 
-	fd = ::open(path, O_RDWR);
+	fd = ::open(path, O_RDWR | O_NONBLOCK);
 	if (fd < 0) {
 		esyslog("%s: open(%s) failed: %s\n", controller_.plugin_name(),
 			path, strerror(errno));
@@ -408,31 +851,87 @@ bool cInputDevice::open(void)
 		goto err;
 	}
 
-	rc = ioctl(fd, EVIOCGNAME(sizeof description - 1), description);
+	rc = ioctl(fd, EVIOCGID, &id);
 	if (rc < 0) {
-		esyslog("%s: ioctl(%s, EVIOCGNAME) failed: %s\n",
+		esyslog("%s: ioctl(%s, EVIOCGID) failed: %s\n",
 			controller_.plugin_name(), path, strerror(errno));
 		goto err;
 	}
 
-	rc = ioctl(fd, EVIOCGBIT(0, sizeof events_mask), events_mask);
-	if (rc < 0) {
-		esyslog("%s: ioctl(%s, EVIOCGBIT) failed: %s\n",
-			controller_.plugin_name(), path, strerror(errno));
-		goto err;
+	// both are optional; most remotes provide at least one of them
+	if (ioctl(fd, EVIOCGUNIQ(sizeof uniq - 1), uniq) < 0)
+		uniq[0] = '\0';
+
+	if (uniq[0] == '\0' && ioctl(fd, EVIOCGPHYS(sizeof phys - 1), phys) < 0)
+		phys[0] = '\0';
+
+	uniq[sizeof uniq - 1] = '\0';
+	phys[sizeof phys - 1] = '\0';
+
+	is_known_ = controller_.get_profiles().lookup(
+		DeviceProfile::make_key(id, uniq, phys), profile_);
+
+	// the key might match a different device (e.g. when the same phys
+	// location is reused); check the cheap properties
+	if (is_known_) {
+		unsigned long	ev_bits[ARRAY_SIZE(profile_.ev_bits)] = { };
+
+		rc = ioctl(fd, EVIOCGBIT(0, sizeof ev_bits), ev_bits);
+		if (rc < 0 ||
+		    memcmp(&id, &profile_.id, sizeof id) != 0 ||
+		    memcmp(ev_bits, profile_.ev_bits, sizeof ev_bits) != 0) {
+			dsyslog("%s: profile %s does not match %s; probing again\n",
+				controller_.plugin_name(), *profile_.key, path);
+			profile_  = DeviceProfile();
+			is_known_ = false;
+		}
+	}
+
+	if (!is_known_) {
+		profile_.key = DeviceProfile::make_key(id, uniq, phys);
+		profile_.id  = id;
+
+		rc = ioctl(fd, EVIOCGNAME(sizeof description - 1), description);
+		if (rc < 0) {
+			esyslog("%s: ioctl(%s, EVIOCGNAME) failed: %s\n",
+				controller_.plugin_name(), path,
+				strerror(errno));
+			goto err;
+		}
+
+		description[sizeof description - 1] = '\0';
+		profile_.name = description;
+
+		rc = ioctl(fd, EVIOCGBIT(0, sizeof profile_.ev_bits),
+			   profile_.ev_bits);
+		if (rc < 0) {
+			esyslog("%s: ioctl(%s, EVIOCGBIT) failed: %s\n",
+				controller_.plugin_name(), path,
+				strerror(errno));
+			goto err;
+		}
+
+		if (test_bit(EV_KEY, profile_.ev_bits)) {
+			rc = ioctl(fd, EVIOCGBIT(EV_KEY,
+						 sizeof profile_.key_bits),
+				   profile_.key_bits);
+			if (rc < 0)
+				memset(profile_.key_bits, 0,
+				       sizeof profile_.key_bits);
+		}
 	}
 
-	if (!test_bit(EV_KEY, events_mask)) {
-		isyslog("%s: skipping %s; no key events\n",
+	if (!test_bit(EV_KEY, profile_.ev_bits) &&
+	    !test_bit(EV_REL, profile_.ev_bits) &&
+	    !test_bit(EV_ABS, profile_.ev_bits)) {
+		isyslog("%s: skipping %s; no key, relative or absolute events\n",
 			controller_.plugin_name(), path);
 		goto err;
 	}
 
-	description[sizeof description - 1] = '\0';
-
 	this->dev_t_ = st.st_rdev;
 	this->fd_ = fd;
-	this->description_ = description;
+	this->description_ = profile_.name;
 
 	return true;
 
@@ -441,15 +940,77 @@ err:
 	return false;
 }
 
-bool cInputDevice::start(int efd)
+// re-reads the EV_KEY capabilities into the profile; returns true when they
+// changed
+bool cInputDevice::update_key_bits(void)
+{
+	unsigned long	bits[ARRAY_SIZE(profile_.key_bits)] = { };
+
+	if (!test_bit(EV_KEY, profile_.ev_bits))
+		return false;
+
+	if (ioctl(fd_, EVIOCGBIT(EV_KEY, sizeof bits), bits) < 0) {
+		dsyslog("%s: %s failed to read key capabilities: %s\n",
+			controller_.plugin_name(), get_dev_path(),
+			strerror(errno));
+		return false;
+	}
+
+	if (memcmp(bits, profile_.key_bits, sizeof bits) == 0)
+		return false;
+
+	memcpy(profile_.key_bits, bits, sizeof bits);
+	return true;
+}
+
+bool cInputDevice::start(void)
 {
 	static unsigned int const	ONE = 1;
 	int			rc;
-	struct epoll_event	ev = { };
 	char const		*dev_path = dev_path_;
+	struct timeval const	tm_null = { 0, 0 };
+	int			clk = CLOCK_MONOTONIC;
+	bool			is_profile_dirty = false;
 
-	ev.events   = EPOLLIN;
-	ev.data.ptr = static_cast<cEpollHandler *>(this);
+	// use the same clock for event timestamps like for the latency
+	// measurement
+	rc = ioctl(fd_, EVIOCSCLOCKID, &clk);
+	if (rc < 0) {
+		dsyslog("%s: %s does not support monotonic timestamps: %s\n",
+			controller_.plugin_name(), dev_path, strerror(errno));
+		clock_id_ = CLOCK_REALTIME;
+	} else {
+		clock_id_ = CLOCK_MONOTONIC;
+	}
+
+	if (test_bit(EV_ABS, profile_.ev_bits))
+		probe_abs();
+
+	// the keymap must be complete before the first event is read
+	if (controller_.get_scancode_maps()) {
+		ScancodeMap const	*map =
+			controller_.get_scancode_maps()->find(profile_.id,
+							      profile_.name);
+		unsigned int		num_failed;
+
+		if (map) {
+			num_failed = map->apply(fd_);
+			isyslog("%s: %s installed scancode map '%s' (%zu entries, %u rejected)\n",
+				controller_.plugin_name(), dev_path,
+				map->get_fname(), map->size(), num_failed);
+
+			// the map can add keycodes; the hotkey check and the
+			// profile must see them
+			is_profile_dirty = update_key_bits();
+		}
+	}
+
+	{
+		SequenceMatcher const	*hotkeys = controller_.get_hotkeys();
+
+		has_hotkeys_ = (hotkeys != NULL &&
+				hotkeys->can_match(profile_.key_bits));
+	}
 
 	rc = ioctl(fd_, EVIOCGRAB, &ONE);
 	if (rc < 0) {
@@ -458,22 +1019,38 @@ bool cInputDevice::start(int efd)
 		goto err;
 	}
 
-	rc = ioctl(fd_, EVIOCGREP, orig_rate_);
-	if (rc < 0) {
+	if (is_known_) {
+		// use the rates from the profile; the device might still have
+		// the ones which have been set before it disconnected
+	} else if (ioctl(fd_, EVIOCGREP, profile_.orig_rate) < 0) {
 		isyslog("%s: %s does not support setup of repeat rate\n",
 			controller_.plugin_name(), dev_path);
-		orig_rate_[0] = 0;
-		orig_rate_[1] = 0;
+		profile_.orig_rate[0] = 0;
+		profile_.orig_rate[1] = 0;
 	}
 
-	repeat_rate_.tv_sec  = (orig_rate_[1] / 1000);
-	repeat_rate_.tv_usec = (orig_rate_[1] % 1000) * 1000;
+	repeat_rate_.tv_sec  = (profile_.orig_rate[1] / 1000);
+	repeat_rate_.tv_usec = (profile_.orig_rate[1] % 1000) * 1000;
 
-	rc = epoll_ctl(efd, EPOLL_CTL_ADD, fd_, &ev);
-	if (rc < 0) {
-		esyslog("%s: epoll_ctl(ADD, <%s>) failed: %s\n",
-			controller_.plugin_name(), dev_path, strerror(errno));
-		goto err;
+	// keys might be held already while attaching the device; key_state_
+	// is still empty so that no release events will be generated.  The
+	// read section covers only the use of the translation table; the
+	// blocking ioctls above must not delay the reclaim of other objects.
+	{
+		EpochGuard	guard(controller_.get_epoch());
+
+		translation_ = get_translation();
+		sync_state(tm_null);
+	}
+
+	// objects which have been retired meanwhile wait for this thread;
+	// the loops must run reclaim() again
+	if (controller_.get_epoch().get_num_retired() > 0)
+		controller_.wakeup_loops();
+
+	if (!is_known_ || is_profile_dirty) {
+		controller_.get_profiles().store(profile_);
+		is_known_ = true;
 	}
 
 	return true;
@@ -482,16 +1059,39 @@ err:
 	return false;
 }
 
+bool cInputDevice::attach(int efd)
+{
+	struct epoll_event	ev = { };
+	int			rc;
+
+	ev.events   = EPOLLIN;
+	ev.data.ptr = static_cast<cEpollHandler *>(this);
+
+	rc = epoll_ctl(efd, EPOLL_CTL_ADD, fd_, &ev);
+	if (rc < 0) {
+		esyslog("%s: epoll_ctl(ADD, <%s>) failed: %s\n",
+			controller_.plugin_name(), get_dev_path(),
+			strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
 void cInputDevice::stop(int efd)
+{
+	epoll_ctl(efd, EPOLL_CTL_DEL, fd_, NULL);
+}
+
+void cInputDevice::release(void)
 {
 	// ignore errors here; there is not very much which can be done in
 	// this situation.  Errors will also happen when devices disconnects
 	// and fd_ refers to a non existing device then.
-	if (orig_rate_[0] != 0 && orig_rate_[1] != 0)
-		ioctl(fd_, EVIOCSREP, orig_rate_);
+	if (profile_.orig_rate[0] != 0 && profile_.orig_rate[1] != 0)
+		ioctl(fd_, EVIOCSREP, profile_.orig_rate);
 
 	ioctl(fd_, EVIOCGRAB, 0);
-	epoll_ctl(efd, EPOLL_CTL_DEL, fd_, NULL);
 }
 
 void cInputDevice::handle_hup(void)
@@ -506,229 +1106,1853 @@ static uint64_t wchar_t_to_ekey(wchar_t c)
 	return KBDKEY(c); 
 }
 
-void cInputDevice::handle_pollin(void)
+static bool is_critical_key(uint64_t key)
 {
-	struct input_event	ev;
-	ssize_t			rc;
+	switch (key) {
+	case kPower:
+	case kStop:
+	case kBack:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool cInputDevice::sync_state(struct timeval const &tm)
+{
+	unsigned long	keys[BITS_TO_LONGS(KEY_CNT)] = { };
+	unsigned long	leds[BITS_TO_LONGS(LED_CNT)] = { };
+	unsigned long	modifiers = 0;
+	int		rc;
+
+	rc = ioctl(fd_, EVIOCGKEY(sizeof keys), keys);
+	if (rc < 0) {
+		esyslog("%s: ioctl(%s, EVIOCGKEY) failed: %s\n",
+			controller_.plugin_name(), get_dev_path(),
+			strerror(errno));
+		return true;
+	}
+
+	// generate release events for keys which were released while events
+	// were dropped
+	for (unsigned int code = 0; code < KEY_CNT; ++code) {
+		struct input_event	ev;
+
+		if (!test_bit(code, key_state_) || test_bit(code, keys))
+			continue;
+
+		ev.time  = tm;
+		ev.type  = EV_KEY;
+		ev.code  = code;
+		ev.value = 0;
+
+		if (!handle_event(ev))
+			return false;
+	}
+
+	memcpy(key_state_, keys, sizeof key_state_);
+
+	for (unsigned int code = 0; code < KEY_CNT; ++code) {
+		TranslationTable::entry_t	e;
+
+		if (!test_bit(code, keys))
+			continue;
+
+		e = translation_->lookup(ModifierMap::ktNORMAL, code);
+		if (TranslationTable::get_action(e) == TranslationTable::acMODIFIER)
+			modifiers |= TranslationTable::get_value(e);
+	}
+
+	// ignore errors; devices without EV_LED capability do not have a
+	// caps lock state
+	rc = ioctl(fd_, EVIOCGLED(sizeof leds), leds);
+	if (rc >= 0 && test_bit(LED_CAPSL, leds))
+		set_bit(ModifierMap::modCAPSLOCK, &modifiers);
+
+	this->modifiers_ = modifiers;
+	this->keytable_  = ModifierMap::get_keytable(modifiers);
+
+	// reset the key filter; the keys which have been seen last are not
+	// known anymore
+	key_filter_.reset();
+
+	// motion of the dropped events is lost
+	memset(rel_delta_, 0, sizeof rel_delta_);
+	memset(rel_pos_, 0, sizeof rel_pos_);
+	has_rel_motion_ = false;
+
+	// absolute axes report their current position; apply it like a
+	// normal frame.  On startup, probe_abs() has read it already.
+	for (size_t i = 0; !Time::is_null(tm) && i < ARRAY_SIZE(abs_); ++i) {
+		struct input_absinfo	info;
+
+		if (!abs_[i].is_valid ||
+		    ioctl(fd_, EVIOCGABS(ABS_AXES[i].code), &info) < 0)
+			continue;
+
+		abs_[i].value   = info.value;
+		abs_frame_time_ = tm;
+		has_abs_motion_ = true;
+	}
+
+	if (has_abs_motion_)
+		flush_abs();
+
+	return true;
+}
+
+bool cInputDevice::flush_frame(void)
+{
+	size_t		cnt = frame_len_;
+
+	frame_len_ = 0;
+
+	for (size_t i = 0; i < cnt; ++i) {
+		if (!handle_event(frame_[i]))
+			// device has been detached
+			return false;
+	}
+
+	if (has_rel_motion_)
+		flush_rel();
+
+	if (has_abs_motion_)
+		flush_abs();
+
+	return true;
+}
+
+void cInputDevice::probe_abs(void)
+{
+	// dead zone and hysteresis in per mille of the half range; the dead
+	// zone is enlarged by the 'flat' value of the driver
+	static int const	PRESS_THRESH = 500;
+	static int const	HYSTERESIS = 200;
+
+	for (size_t i = 0; i < ARRAY_SIZE(abs_); ++i) {
+		struct abs_state	&st = abs_[i];
+		struct input_absinfo	info;
+		int			flat;
+
+		st.is_valid = false;
+
+		if (ioctl(fd_, EVIOCGABS(ABS_AXES[i].code), &info) < 0 ||
+		    info.maximum <= info.minimum)
+			continue;
+
+		st.center     = info.minimum + (info.maximum - info.minimum) / 2;
+		st.half_range = std::max((info.maximum - info.minimum) / 2, 1);
+
+		flat = (int64_t)std::max(info.flat, 0) * 1000 / st.half_range;
+
+		st.press_thresh   = std::min(std::max(PRESS_THRESH, flat + 100),
+					     900);
+		st.release_thresh = std::max(st.press_thresh - HYSTERESIS,
+					     std::min(flat, st.press_thresh));
+		st.value          = info.value;
+		st.dir            = 0;
+		st.is_valid       = true;
+	}
+}
+
+void cInputDevice::handle_abs(struct input_event const &ev)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(ABS_AXES); ++i) {
+		if (ABS_AXES[i].code != ev.code || !abs_[i].is_valid)
+			continue;
+
+		abs_[i].value   = ev.value;
+		abs_frame_time_ = ev.time;
+		has_abs_motion_ = true;
+		break;
+	}
+}
+
+void cInputDevice::send_abs_key(enum abs_axis axis, int dir, bool is_released)
+{
+	struct KeyEvent		key;
+
+	key.ev.time  = abs_frame_time_;
+	key.ev.type  = EV_ABS;
+	key.ev.code  = ABS_AXES[axis].code;
+	key.ev.value = dir;
+
+	key.code        = dir < 0 ? ABS_AXES[axis].key_neg :
+		ABS_AXES[axis].key_pos;
+	key.is_raw      = true;
+	key.is_repeated = false;
+	key.is_released = is_released;
+	key.is_critical = false;
+
+	// directions are repeated by the plugin; the device reports only
+	// position changes
+	submit_key(key, (is_released ? cInputKeyRepeater::hoRELEASE :
+			 cInputKeyRepeater::hoPRESS));
+}
+
+void cInputDevice::flush_abs(void)
+{
+	has_abs_motion_ = false;
+
+	for (size_t i = 0; i < ARRAY_SIZE(abs_); ++i) {
+		struct abs_state	&st = abs_[i];
+		enum abs_axis		axis = static_cast<enum abs_axis>(i);
+		int			pos;
+		int			dir;
+
+		if (!st.is_valid)
+			continue;
+
+		pos = (int64_t)(st.value - st.center) * 1000 / st.half_range;
+
+		// the hysteresis keeps a direction until the axis moved back
+		// below the release threshold; noise around a threshold does
+		// not cause key events
+		if (st.dir != 0 && pos * st.dir >= st.release_thresh)
+			dir = st.dir;
+		else if (pos >= st.press_thresh)
+			dir = +1;
+		else if (pos <= -st.press_thresh)
+			dir = -1;
+		else
+			dir = 0;
+
+		if (dir == st.dir)
+			continue;
+
+		if (st.dir != 0)
+			send_abs_key(axis, st.dir, true);
+
+		if (dir != 0)
+			send_abs_key(axis, dir, false);
+
+		st.dir = dir;
+	}
+}
+
+void cInputDevice::handle_rel(struct input_event const &ev)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(REL_AXES); ++i) {
+		if (REL_AXES[i].code != ev.code)
+			continue;
+
+		rel_delta_[i]  += ev.value;
+		rel_frame_time_ = ev.time;
+		has_rel_motion_ = true;
+		break;
+	}
+}
+
+void cInputDevice::flush_rel(void)
+{
+	// upper limit of keys per axis and frame; protects against bogus
+	// values
+	static int const	MAX_KEYS = 8;
+	// accumulated motion is discarded after this idle time
+	static int64_t const	IDLE_US = 500000;
+
+	struct timeval const	&tm = rel_frame_time_;
+
+	has_rel_motion_ = false;
+
+	for (size_t i = 0; i < ARRAY_SIZE(REL_AXES); ++i) {
+		int		delta = rel_delta_[i];
+		int		pos = rel_pos_[i];
+		int		thresh;
+		int		cnt;
+		int64_t		idle;
+
+		if (delta == 0)
+			continue;
+
+		rel_delta_[i] = 0;
+
+		idle = ((int64_t)(tm.tv_sec - rel_time_[i].tv_sec) * 1000000 +
+			tm.tv_usec - rel_time_[i].tv_usec);
+
+		// restart on direction changes
+		if ((pos > 0) != (delta > 0) || idle > IDLE_US)
+			pos = 0;
+
+		thresh = __atomic_load_n(&rel_threshold_[i], __ATOMIC_RELAXED);
+		pos   += delta;
+		cnt    = pos / thresh;
+		pos   -= cnt * thresh;
+
+		rel_pos_[i]  = pos;
+		rel_time_[i] = tm;
+
+		for (int k = 0; k < std::min(abs(cnt), MAX_KEYS); ++k) {
+			struct KeyEvent		key;
+
+			key.ev.time  = tm;
+			key.ev.type  = EV_REL;
+			key.ev.code  = REL_AXES[i].code;
+			key.ev.value = cnt > 0 ? 1 : -1;
+
+			key.code        = cnt > 0 ? REL_AXES[i].key_pos :
+				REL_AXES[i].key_neg;
+			key.is_raw      = true;
+			key.is_repeated = false;
+			key.is_released = false;
+			key.is_critical = false;
+
+			submit_key(key);
+		}
+	}
+}
+
+// 'hold' tells how the key affects the repeat by the plugin; see
+// cInputKeyRepeater::queue_key()
+void cInputDevice::submit_key(struct KeyEvent &key,
+			      enum cInputKeyRepeater::hold hold)
+{
+	struct input_event const	&ev = key.ev;
+	bool				is_queued;
+
+	key.clock_id = clock_id_;
+	key.stats    = stats_->ref();
+
+	if (hold == cInputKeyRepeater::hoNONE)
+		is_queued = controller_.queue_key(key);
+	else
+		is_queued = controller_.get_repeater().queue_key(this, key,
+								 hold);
+
+	if (!is_queued) {
+		esyslog("%s: key queue overflow; dropping [%02x,%04x,%u] from %s\n",
+			controller_.plugin_name(), ev.type, ev.code, ev.value,
+			get_dev_path());
+		stats_->unref();
+	}
+}
+
+bool cInputDevice::queue_event(struct input_event const &ev)
+{
+	if (ev.type == EV_SYN && ev.code == SYN_DROPPED) {
+		isyslog("%s: %s dropped events; resyncing\n",
+			controller_.plugin_name(), get_dev_path());
+		stats_->add(DeviceStats::cntSYN_DROPPED);
+
+		// discard the partial frame and all events up to the next
+		// SYN_REPORT
+		frame_len_   = 0;
+		syn_dropped_ = true;
+		return true;
+	}
+
+	if (syn_dropped_) {
+		if (ev.type != EV_SYN || ev.code != SYN_REPORT)
+			return true;
+
+		syn_dropped_ = false;
+		return sync_state(ev.time);
+	}
+
+	if (ev.type == EV_SYN && ev.code == SYN_REPORT)
+		return flush_frame();
+
+	if (frame_len_ == ARRAY_SIZE(frame_)) {
+		dsyslog("%s: %s sent overlong frame\n",
+			controller_.plugin_name(), get_dev_path());
+
+		if (!flush_frame())
+			return false;
+	}
+
+	frame_[frame_len_++] = ev;
+	return true;
+}
+
+void cInputDevice::handle_pollin(void)
+{
+	struct input_event	events[64];
+	ssize_t			rc;
+
+	translation_ = get_translation();
+
+	{
+		struct timespec	now;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		stats_->set_last_event(now.tv_sec * 1000000ll +
+				       now.tv_nsec / 1000);
+	}
+
+	for (;;) {
+		size_t		cnt;
+
+		rc = read(fd_, events, sizeof events);
+		if (rc < 0 && errno == EINTR)
+			continue;
+
+		if (rc < 0 && errno == EAGAIN)
+			break;
+
+		if (rc < 0 && errno == ENODEV) {
+			isyslog("%s: device '%s' removed\n",
+				controller_.plugin_name(), get_dev_path());
+			controller_.remove_device(this);
+			return;
+		}
+
+		if (rc < 0) {
+			esyslog("%s: failed to read from %s: %s\n",
+				controller_.plugin_name(), get_dev_path(),
+				strerror(errno));
+			return;
+		}
+
+		if ((size_t)rc % sizeof events[0] != 0) {
+			esyslog("%s: read unexpected amount %zd of data\n",
+				controller_.plugin_name(), rc);
+			return;
+		}
+
+		cnt = (size_t)rc / sizeof events[0];
+
+		stats_->add(DeviceStats::cntEVENTS, cnt);
+		stats_->add(DeviceStats::cntBYTES, rc);
+
+		for (size_t i = 0; i < cnt; ++i) {
+			if (!queue_event(events[i]))
+				return;
+		}
+
+		// a short read means that the kernel buffer has been
+		// drained; avoid the extra syscall which would return
+		// EAGAIN
+		if (cnt < ARRAY_SIZE(events))
+			break;
+	}
+}
 
+bool cInputDevice::handle_event(struct input_event const &ev)
+{
 	uint64_t		code;
 	bool			is_released = false;
 	bool			is_repeated = false;
 	bool			is_valid;
 	bool			is_internal = false;
 	bool			is_raw = false;
+	struct KeyEvent		key;
 
-	rc = read(fd_, &ev, sizeof ev);
-	if (rc < 0 && errno == EINTR)
-		return;
+	if (ev.type == EV_REL) {
+		// keys are generated at the end of the frame
+		handle_rel(ev);
+		return true;
+	}
+
+	if (ev.type == EV_ABS) {
+		handle_abs(ev);
+		return true;
+	}
+
+	// \todo: do something useful with the other events...
+	if (ev.type != EV_KEY)
+		// ignore events which are no valid key events
+		return true;
+
+	bool const	soft_repeat = profile_.quirks.has_soft_repeat();
+
+	if (soft_repeat && ev.value == 2)
+		// generated by cInputKeyRepeater; drop repeats of drivers
+		// which do not use the kernel autorepeat
+		return true;
+
+	// with 'broken_repeat', the same key must not arrive faster than
+	// configured by EVIOCSREP
+	if (!key_filter_.accept(ev, (!profile_.quirks.has_broken_repeat() ? 0 :
+				     repeat_rate_.tv_sec * 1000 +
+				     repeat_rate_.tv_usec / 1000))) {
+		if (ev.value == 1)
+			dsyslog("%s: %s received key too fast\n",
+				controller_.plugin_name(), get_dev_path());
+
+		stats_->add(DeviceStats::cntSUPPRESSED);
+		return true;
+	}
+
+	if (0)
+		dsyslog("%s: event{%s}=[%lu.%06u, %02x, %04x, %d]\n",
+			controller_.plugin_name(), get_dev_path(),
+			(unsigned long)(ev.time.tv_sec),
+			(unsigned int)(ev.time.tv_usec),
+			ev.type, ev.code, ev.value);
+
+	if (has_hotkeys_ &&
+	    !handle_hotkey(controller_.get_hotkeys()->step(hotkey_state_, ev)))
+		// device has been detached
+		return false;
+
+	switch (ev.type) {
+	case EV_KEY: {
+		TranslationTable::entry_t	e;
+		unsigned long			mask;
+
+		is_valid = true;
+
+		switch (ev.value) {
+		case 0:
+			is_released = true;
+			break;
+		case 1:
+			break;
+		case 2:
+			is_repeated = true;
+			break;
+		default:
+			is_valid = false;
+			break;
+		}
+
+		if (ev.code < KEY_CNT && is_released)
+			clear_bit(ev.code, key_state_);
+		else if (ev.code < KEY_CNT && is_valid)
+			set_bit(ev.code, key_state_);
+
+		// caps lock is a toggle; its state is initialized from the led
+		// by sync_state().  The key itself is still reported.
+		if (ev.code == KEY_CAPSLOCK && ev.value == 1)
+			toggle_capslock();
+
+		e = translation_->lookup(this->keytable_, ev.code);
+
+		switch (TranslationTable::get_action(e)) {
+		case TranslationTable::acMODIFIER:
+			mask = TranslationTable::get_value(e);
+			is_internal = true;
+
+			if (is_released)
+				this->modifiers_ &= ~mask;
+			else if (is_valid)
+				this->modifiers_ |=  mask;
+			else
+				// repeated events
+				break;
+
+			this->keytable_ = ModifierMap::get_keytable(modifiers_);
+			break;
+
+		case TranslationTable::acRAW:
+			code = wchar_t_to_ekey(TranslationTable::get_value(e));
+			is_raw = true;
+			break;
+
+		case TranslationTable::acKEY:
+			code = TranslationTable::get_value(e);
+			is_raw = true;
+			break;
+
+		case TranslationTable::acCODE:
+		default:
+			code = generate_code(0, ev.type, ev.code);
+			is_raw = false;
+			break;
+		}
+
+		break;
+	}
+
+	default:
+		is_valid = false;
+		break;
+	}
+
+	if (is_internal) {
+		// like with kernel autorepeat, pressing a modifier stops the
+		// repeat of the previous key
+		if (soft_repeat && is_valid && !is_released)
+			controller_.get_repeater().cancel(this);
+
+		return true;
+	}
+
+	if (!is_valid) {
+		esyslog("%s: unexpected key events [%02x,%04x,%u]\n",
+			controller_.plugin_name(), ev.type, ev.code, ev.value);
+		return true;
+	}
+
+	key.ev          = ev;
+	key.code        = code;
+	key.is_raw      = is_raw;
+	key.is_repeated = is_repeated;
+	key.is_released = is_released;
+	key.is_critical = (is_raw ? is_critical_key(code) :
+			   ev.code < KEY_CNT && is_critical_key(key_table_[ev.code]));
+
+	// without the quirk, repeats are done by the kernel
+	if (!soft_repeat)
+		submit_key(key);
+	else if (is_released)
+		submit_key(key, cInputKeyRepeater::hoRELEASE);
+	else if (key_filter_.allows_repeat(ev.code))
+		submit_key(key, cInputKeyRepeater::hoPRESS);
+	else
+		// the key stops the repeat of the previous one
+		submit_key(key, cInputKeyRepeater::hoCANCEL);
+
+	return true;
+}
+
+void cInputDevice::toggle_capslock(void)
+{
+	struct input_event	led = { };
+
+	change_bit(ModifierMap::modCAPSLOCK, &this->modifiers_);
+	this->keytable_ = ModifierMap::get_keytable(modifiers_);
+
+	// update the led so that a later sync_state() reads the same state;
+	// devices without EV_LED capability reject the write
+	led.type  = EV_LED;
+	led.code  = LED_CAPSL;
+	led.value = test_bit(ModifierMap::modCAPSLOCK, &this->modifiers_);
+
+	if (write(fd_, &led, sizeof led) < 0 && errno != EINVAL)
+		dsyslog("%s: failed to set capslock led of %s: %s\n",
+			controller_.plugin_name(), get_dev_path(),
+			strerror(errno));
+}
+
+bool cInputDevice::handle_hotkey(enum SequenceMatcher::action act)
+{
+	if (act != SequenceMatcher::acNONE)
+		isyslog("%s: hotkey '%s' from %s\n", controller_.plugin_name(),
+			SequenceMatcher::get_action_name(act), get_dev_path());
+
+	switch (act) {
+	case SequenceMatcher::acNONE:
+		break;
+
+	case SequenceMatcher::acDETACH:
+		controller_.remove_device(this);
+		return false;
+
+	case SequenceMatcher::acREATTACH:
+		controller_.reattach_devices();
+		break;
+
+	case SequenceMatcher::acRELOAD_MODMAP:
+		controller_.reload_modmap();
+		break;
+
+	case SequenceMatcher::acDUMP_STATS:
+		controller_.log_stats();
+		break;
+	}
+
+	return true;
+}
+
+bool cInputDevice::set_repeat_rate(unsigned int delay_ms,
+				   unsigned int rate_ms)
+{
+	unsigned int	rep[2] = { delay_ms, rate_ms };
+	int		rc;
+
+	if (profile_.quirks.has_soft_repeat()) {
+		// cInputKeyRepeater generates the repeats; a zero period
+		// disables the kernel autorepeat
+		rep[0] = 0;
+		rep[1] = 0;
+
+		repeat_rate_.tv_sec  = (rate_ms / 1000);
+		repeat_rate_.tv_usec = (rate_ms % 1000) * 1000;
+	}
+
+	if (!has_orig_repeate_rate()) {
+		dsyslog("%s: %s skipping setup of repeat rate because original one is unknown\n",
+			controller_.plugin_name(), get_dev_path());
+		return true;		// no error
+	}
+
+	rc = ioctl(fd_, EVIOCSREP, rep);
+	if (rc < 0) {
+		esyslog("%s: %s failed to set repeat rate: %s\n",
+			controller_.plugin_name(), get_dev_path(),
+			strerror(errno));
+
+		repeat_rate_.tv_sec  = 0;
+		repeat_rate_.tv_usec = 0;
+
+		return false;
+	}
+
+	rc = ioctl(fd_, EVIOCGREP, rep);
+	if (rc >= 0) {
+		isyslog("%s: %s has repeat rate setting of [%u,%u]\n",
+			controller_.plugin_name(), get_dev_path(),
+			rep[0], rep[1]);
+
+		// todo: handle this as an error?
+
+		if (!profile_.quirks.has_soft_repeat())
+			rate_ms = rep[1];
+	}
+
+	repeat_rate_.tv_sec  = (rate_ms / 1000);
+	repeat_rate_.tv_usec = (rate_ms % 1000) * 1000;
+
+	return true;
+}
+
+// ===========================
+
+// Submits queued keys to vdr; cRemote::Put() takes a mutex shared with the
+// vdr main loop and must not stall reading of the input devices.
+//
+// Keys are moved from the queue into a small pending buffer.  While vdr is
+// busy (Put() failed or the oldest key is stale), repeats are collapsed into
+// the newest event of the same key, stale repeats are dropped and repeats
+// before a critical key are discarded so that they cannot delay it.  Keys
+// rejected by Put() stay at the head of the buffer and are retried a
+// limited number of times.
+class cInputKeyDelivery : protected cThread {
+private:
+	enum {
+		PENDING_MAX		= 64,
+		// age of the oldest key which signals a backlog; older
+		// repeats are dropped then
+		STALE_MS		= 250,
+		RETRY_MS		= 20,
+		RETRY_MAX		= 5,
+	};
+
+	cInputDeviceController	&controller_;
+	KeyQueue		&queue_;
+
+	struct KeyEvent		pending_[PENDING_MAX];
+	size_t			num_pending_;
+	// failed Put() attempts of 'pending_[0]'
+	unsigned int		num_retries_;
+	bool			is_backlogged_;
+
+	// head of the critical lane; delivered before 'pending_'
+	struct KeyEvent		critical_;
+	bool			has_critical_;
+
+	void		fill(void);
+	void		drop(size_t idx);
+	void		collapse(void);
+	bool		deliver(struct KeyEvent const &key);
+	void		deliver_critical(void);
+
+	static int64_t	get_age_us(struct KeyEvent const &key);
+
+	cInputKeyDelivery(cInputKeyDelivery const &);
+	cInputKeyDelivery & operator = (cInputKeyDelivery const &);
+
+protected:
+	virtual void	Action(void);
+
+public:
+	cInputKeyDelivery(cInputDeviceController &controller, KeyQueue &queue);
+	virtual ~cInputKeyDelivery();
+
+	bool		start(void);
+	void		stop(void);
+};
+
+cInputKeyDelivery::cInputKeyDelivery(cInputDeviceController &controller,
+				     KeyQueue &queue) :
+	controller_(controller), queue_(queue), num_pending_(0),
+	num_retries_(0), is_backlogged_(false), has_critical_(false)
+{
+	SetDescription("inputdev delivery");
+}
+
+cInputKeyDelivery::~cInputKeyDelivery()
+{
+	for (size_t i = 0; i < num_pending_; ++i)
+		pending_[i].stats->unref();
+
+	if (has_critical_)
+		critical_.stats->unref();
+}
+
+bool cInputKeyDelivery::start(void)
+{
+	return cThread::Start();
+}
+
+void cInputKeyDelivery::stop(void)
+{
+	Cancel(-1);
+	queue_.wakeup();
+	Cancel(5);
+}
+
+int64_t cInputKeyDelivery::get_age_us(struct KeyEvent const &key)
+{
+	struct timespec		now;
+
+	clock_gettime(key.clock_id, &now);
+	return Time::diff_us(now, key.ev.time);
+}
+
+void cInputKeyDelivery::fill(void)
+{
+	while (num_pending_ < ARRAY_SIZE(pending_) &&
+	       queue_.pop(pending_[num_pending_]))
+		++num_pending_;
+}
+
+void cInputKeyDelivery::drop(size_t idx)
+{
+	pending_[idx].stats->unref();
+
+	--num_pending_;
+	memmove(&pending_[idx], &pending_[idx + 1],
+		(num_pending_ - idx) * sizeof pending_[0]);
+}
+
+void cInputKeyDelivery::collapse(void)
+{
+	size_t		cnt = 0;
+
+	for (size_t i = 0; i < num_pending_; ++i) {
+		struct KeyEvent const	&key = pending_[i];
+		bool			is_obsolete;
+
+		is_obsolete = (key.is_repeated &&
+			       get_age_us(key) > STALE_MS * 1000);
+
+		// a later event of the same key supersedes the repeat; codes
+		// of EV_KEY, EV_ABS and EV_REL overlap
+		for (size_t j = i + 1;
+		     key.is_repeated && !is_obsolete && j < num_pending_;
+		     ++j) {
+			struct KeyEvent const	&next = pending_[j];
+
+			if (next.stats == key.stats &&
+			    next.ev.type == key.ev.type &&
+			    next.ev.code == key.ev.code)
+				is_obsolete = true;
+		}
+
+		if (is_obsolete) {
+			key.stats->add(DeviceStats::cntCOALESCED);
+			key.stats->unref();
+		} else {
+			pending_[cnt++] = key;
+		}
+	}
+
+	num_pending_ = cnt;
+}
+
+bool cInputKeyDelivery::deliver(struct KeyEvent const &key)
+{
+	struct input_event const	&ev = key.ev;
+	bool				rc;
+
+	if (key.is_raw)
+		rc = controller_.PutRaw(key.code, key.is_repeated,
+					key.is_released);
+	else
+		rc = controller_.Put(key.code, key.is_repeated,
+				     key.is_released);
+
+	if (!rc) {
+		esyslog("%s: failed to put [%02x,%04x,%u] %sevent [%016" PRIX64 ", %d, %d]\n",
+			controller_.plugin_name(), ev.type, ev.code, ev.value,
+			key.is_raw ? "raw " : "",
+			key.code, key.is_repeated, key.is_released);
+		key.stats->add(DeviceStats::cntPUT_FAILED);
+	} else {
+		int64_t			delta = get_age_us(key);
+
+		if (delta < 0)
+			delta = 0;
+		else if (delta > 0xffffffffll)
+			delta = 0xffffffffll;
+
+		key.stats->latency.add(delta);
+		key.stats->add(DeviceStats::cntKEYS);
+	}
+
+	return rc;
+}
+
+void cInputKeyDelivery::deliver_critical(void)
+{
+	if (deliver(critical_)) {
+		is_backlogged_ = false;
+	} else if (!critical_.is_repeated) {
+		// never given up; Put() fails only while the key buffer of
+		// vdr is full
+		is_backlogged_ = true;
+		cCondWait::SleepMs(RETRY_MS);
+		return;
+	}
+
+	critical_.stats->unref();
+	has_critical_ = false;
+}
+
+void cInputKeyDelivery::Action(void)
+{
+	controller_.apply_scheduling("key delivery");
+
+	while (Running()) {
+		// critical keys bypass the keys which are pending already
+		if (!has_critical_)
+			has_critical_ = queue_.pop_critical(critical_);
+
+		if (has_critical_) {
+			deliver_critical();
+			continue;
+		}
+
+		fill();
+
+		if (num_pending_ == 0) {
+			queue_.wait(-1);
+			continue;
+		}
+
+		if (is_backlogged_ || get_age_us(pending_[0]) > STALE_MS * 1000)
+			collapse();
+
+		struct KeyEvent const	&key = pending_[0];
+
+		if (deliver(key)) {
+			is_backlogged_ = false;
+			num_retries_   = 0;
+			drop(0);
+			continue;
+		}
+
+		is_backlogged_ = true;
+
+		if (key.is_repeated || ++num_retries_ >= RETRY_MAX) {
+			// repeats are not retried; the next one follows soon
+			if (!key.is_repeated)
+				esyslog("%s: giving up to put [%02x,%04x,%u]\n",
+					controller_.plugin_name(),
+					key.ev.type, key.ev.code, key.ev.value);
+
+			num_retries_ = 0;
+			drop(0);
+		} else {
+			cCondWait::SleepMs(RETRY_MS);
+		}
+	}
+}
+
+// ===========================
+
+// Eventfd in an epoll set which interrupts epoll_wait().  Event loops stay
+// in their epoch read section while waiting; they are woken up when
+// retired objects are waiting for them.
+class cEpollWakeup : public cEpollHandler {
+private:
+	int		fd_;
+
+	cEpollWakeup(cEpollWakeup const &);
+	cEpollWakeup & operator = (cEpollWakeup const &);
+
+public:
+	cEpollWakeup() : fd_(-1) {}
+	virtual ~cEpollWakeup() {
+		cInputDeviceController::close(fd_);
+	}
+
+	bool		open(int efd);
+	void		kick(void);
+
+	virtual void	handle_hup() {}
+	virtual void	handle_pollin();
+};
+
+bool cEpollWakeup::open(int efd)
+{
+	struct epoll_event	ev = { };
+
+	fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (fd_ < 0)
+		return false;
+
+	ev.events   = EPOLLIN;
+	ev.data.ptr = static_cast<cEpollHandler *>(this);
+
+	if (epoll_ctl(efd, EPOLL_CTL_ADD, fd_, &ev) < 0) {
+		cInputDeviceController::close(fd_);
+		return false;
+	}
+
+	return true;
+}
+
+void cEpollWakeup::kick(void)
+{
+	uint64_t	v = 1;
+	ssize_t		rc;
+
+	if (fd_ < 0)
+		return;
+
+	rc = write(fd_, &v, sizeof v);
+	(void)rc;
+}
+
+void cEpollWakeup::handle_pollin(void)
+{
+	uint64_t	v;
+	ssize_t		rc;
+
+	rc = read(fd_, &v, sizeof v);
+	(void)rc;
+}
+
+// Hash index of the registered devices by dev_t and by path.  Devices are
+// chained through their 'next_by_*' members.  Modifications must be done
+// with the 'dev_mutex_' of the controller held; lookups require only an
+// EpochGuard because removed devices (and their links) stay valid until
+// all readers left.
+class cInputDeviceIndex {
+private:
+	static size_t const	NUM_BUCKETS = 64;
+
+	class cInputDevice	*by_rdev_[NUM_BUCKETS];
+	class cInputDevice	*by_path_[NUM_BUCKETS];
+
+	static size_t		get_bucket(dev_t rdev) {
+		// minor numbers of event devices are consecutive
+		return (major(rdev) * 31u + minor(rdev)) % NUM_BUCKETS;
+	}
+
+	static size_t		get_bucket(uint32_t hash) {
+		return hash % NUM_BUCKETS;
+	}
+
+public:
+	cInputDeviceIndex() {
+		memset(by_rdev_, 0, sizeof by_rdev_);
+		memset(by_path_, 0, sizeof by_path_);
+	}
+
+	void		add(class cInputDevice *dev);
+	void		remove(class cInputDevice *dev);
+
+	class cInputDevice	*find(dev_t rdev) const;
+	class cInputDevice	*find(char const *path) const;
+};
+
+void cInputDeviceIndex::add(class cInputDevice *dev)
+{
+	class cInputDevice	**rdev_head = &by_rdev_[get_bucket(dev->dev_t_)];
+	class cInputDevice	**path_head = &by_path_[get_bucket(dev->path_hash_)];
+
+	// initialize the links before publishing the device
+	dev->next_by_rdev_ = *rdev_head;
+	dev->next_by_path_ = *path_head;
+
+	__atomic_store_n(rdev_head, dev, __ATOMIC_RELEASE);
+	__atomic_store_n(path_head, dev, __ATOMIC_RELEASE);
+}
+
+void cInputDeviceIndex::remove(class cInputDevice *dev)
+{
+	class cInputDevice	**ptr;
+
+	for (ptr = &by_rdev_[get_bucket(dev->dev_t_)]; *ptr != dev;
+	     ptr = &(*ptr)->next_by_rdev_)
+		assert(*ptr != NULL);
+
+	// the links of 'dev' are kept; concurrent readers might still walk
+	// over it
+	__atomic_store_n(ptr, dev->next_by_rdev_, __ATOMIC_RELEASE);
+
+	for (ptr = &by_path_[get_bucket(dev->path_hash_)]; *ptr != dev;
+	     ptr = &(*ptr)->next_by_path_)
+		assert(*ptr != NULL);
+
+	__atomic_store_n(ptr, dev->next_by_path_, __ATOMIC_RELEASE);
+}
+
+class cInputDevice *cInputDeviceIndex::find(dev_t rdev) const
+{
+	class cInputDevice	*dev;
+
+	for (dev = __atomic_load_n(&by_rdev_[get_bucket(rdev)], __ATOMIC_ACQUIRE);
+	     dev != NULL;
+	     dev = __atomic_load_n(&dev->next_by_rdev_, __ATOMIC_ACQUIRE)) {
+		if (dev->dev_t_ == rdev)
+			break;
+	}
+
+	return dev;
+}
+
+class cInputDevice *cInputDeviceIndex::find(char const *path) const
+{
+	uint32_t		hash = fnv1a_hash(path);
+	class cInputDevice	*dev;
+
+	for (dev = __atomic_load_n(&by_path_[get_bucket(hash)], __ATOMIC_ACQUIRE);
+	     dev != NULL;
+	     dev = __atomic_load_n(&dev->next_by_path_, __ATOMIC_ACQUIRE)) {
+		if (dev->path_hash_ == hash &&
+		    strcmp(dev->dev_path_, path) == 0)
+			break;
+	}
+
+	return dev;
+}
+
+// Small thread pool which executes the device related commands and the
+// final release of removed devices.  Opening and configuring a device
+// requires several ioctls which can block for a long time on broken or
+// wireless devices; doing this here keeps the event loops and the vdr
+// startup free of them.
+//
+// Commands for the same device path are executed in the order in which
+// they have been queued.
+class cInputDeviceJob : public cListObject {
+public:
+	cString			cmd;
+	cString			dev_path;
+	class cInputDevice	*dev;		// only for release jobs
+	bool			is_busy;
+
+	cInputDeviceJob(char const *cmd_, char const *dev_path_,
+			class cInputDevice *dev_) :
+		cmd(cmd_), dev_path(dev_path_), dev(dev_), is_busy(false) {}
+};
+
+class cInputDeviceWorker : protected cThread {
+private:
+	class cInputDeviceJobs	&jobs_;
+
+	cInputDeviceWorker(cInputDeviceWorker const &);
+	cInputDeviceWorker & operator = (cInputDeviceWorker const &);
+
+protected:
+	virtual void	Action(void);
+
+public:
+	explicit cInputDeviceWorker(class cInputDeviceJobs &jobs) : jobs_(jobs) {
+		SetDescription("inputdev worker");
+	}
+
+	bool		start(void) { return cThread::Start(); }
+	void		cancel(void) { Cancel(-1); }
+	void		stop(void) { Cancel(5); }
+	bool		is_running(void) { return Running(); }
+};
+
+class cInputDeviceJobs {
+private:
+	static size_t const	NUM_WORKERS = 4;
+
+	cInputDeviceController	&controller_;
+	class cInputDeviceWorker	*workers_[NUM_WORKERS];
+
+	cMutex			lock_;
+	cCondVar		cond_;
+	cList<cInputDeviceJob>	jobs_;
+	bool			is_started_;
+	unsigned int		num_failed_;
+
+	cInputDeviceJobs(cInputDeviceJobs const &);
+	cInputDeviceJobs & operator = (cInputDeviceJobs const &);
+
+	void			queue(cInputDeviceJob *job);
+	cInputDeviceJob		*get_runnable(void);
+	void			execute(cInputDeviceJob *job);
+
+	friend class cInputDeviceWorker;
+
+public:
+	explicit cInputDeviceJobs(cInputDeviceController &controller);
+	~cInputDeviceJobs();
+
+	void		start(void);
+	void		stop(void);
+
+	void		queue_command(char const *cmd, char const *dev_name);
+	void		queue_release(class cInputDevice *dev);
+
+	// waits until all queued jobs have been executed and returns the
+	// number of commands which failed since the last call
+	unsigned int	wait_idle(void);
+};
+
+cInputDeviceJobs::cInputDeviceJobs(cInputDeviceController &controller) :
+	controller_(controller), is_started_(false), num_failed_(0)
+{
+	for (size_t i = 0; i < NUM_WORKERS; ++i)
+		workers_[i] = new cInputDeviceWorker(*this);
+}
+
+cInputDeviceJobs::~cInputDeviceJobs()
+{
+	stop();
+
+	for (size_t i = 0; i < NUM_WORKERS; ++i)
+		delete workers_[i];
+
+	// execute pending releases; commands are dropped
+	for (;;) {
+		cInputDeviceJob	*job = jobs_.First();
+
+		if (!job)
+			break;
+
+		jobs_.Del(job, false);
+		if (job->dev) {
+			job->dev->release();
+			controller_.get_epoch().retire(job->dev);
+		}
+
+		delete job;
+	}
+}
+
+void cInputDeviceJobs::start(void)
+{
+	if (is_started_)
+		return;
+
+	for (size_t i = 0; i < NUM_WORKERS; ++i)
+		workers_[i]->start();
+
+	is_started_ = true;
+}
+
+void cInputDeviceJobs::stop(void)
+{
+	if (!is_started_)
+		return;
+
+	for (size_t i = 0; i < NUM_WORKERS; ++i)
+		workers_[i]->cancel();
+
+	lock_.Lock();
+	cond_.Broadcast();
+	lock_.Unlock();
+
+	for (size_t i = 0; i < NUM_WORKERS; ++i)
+		workers_[i]->stop();
+
+	is_started_ = false;
+}
+
+void cInputDeviceJobs::queue(cInputDeviceJob *job)
+{
+	if (!is_started_) {
+		// happens only during shutdown
+		execute(job);
+		delete job;
+		return;
+	}
+
+	lock_.Lock();
+	jobs_.Add(job);
+	cond_.Broadcast();
+	lock_.Unlock();
+}
+
+void cInputDeviceJobs::queue_command(char const *cmd, char const *dev_name)
+{
+	queue(new cInputDeviceJob(cmd,
+				  cInputDeviceController::get_dev_path(dev_name),
+				  NULL));
+}
+
+void cInputDeviceJobs::queue_release(class cInputDevice *dev)
+{
+	queue(new cInputDeviceJob(NULL, NULL, dev));
+}
+
+// must be called with 'lock_' held
+cInputDeviceJob *cInputDeviceJobs::get_runnable(void)
+{
+	for (cInputDeviceJob *job = jobs_.First(); job; job = jobs_.Next(job)) {
+		bool	is_blocked = false;
+
+		if (job->is_busy)
+			continue;
+
+		// release jobs are not related to a path and can always be
+		// executed
+		for (cInputDeviceJob *prev = jobs_.First();
+		     prev != job && !is_blocked && *job->dev_path != NULL;
+		     prev = jobs_.Next(prev))
+			is_blocked = (*prev->dev_path != NULL &&
+				      strcmp(prev->dev_path, job->dev_path) == 0);
+
+		if (!is_blocked)
+			return job;
+	}
+
+	return NULL;
+}
+
+void cInputDeviceJobs::execute(cInputDeviceJob *job)
+{
+	if (job->dev) {
+		job->dev->release();
+
+		// event loops might still access the device in their current
+		// batch
+		controller_.retire(job->dev);
+	} else if (!controller_.run_device_command(job->cmd, job->dev_path)) {
+		__atomic_add_fetch(&num_failed_, 1, __ATOMIC_RELAXED);
+	}
+}
+
+unsigned int cInputDeviceJobs::wait_idle(void)
+{
+	cMutexLock	lock(&lock_);
+
+	while (jobs_.First() != NULL)
+		cond_.Wait(lock_);
+
+	return __atomic_exchange_n(&num_failed_, 0, __ATOMIC_RELAXED);
+}
+
+void cInputDeviceWorker::Action(void)
+{
+	cMutex		&lock = jobs_.lock_;
+
+	lock.Lock();
+	while (Running()) {
+		cInputDeviceJob	*job = jobs_.get_runnable();
+
+		if (!job) {
+			jobs_.cond_.TimedWait(lock, 1000);
+			continue;
+		}
+
+		job->is_busy = true;
+		lock.Unlock();
+
+		jobs_.execute(job);
+
+		lock.Lock();
+		jobs_.jobs_.Del(job);
+		jobs_.cond_.Broadcast();
+	}
+	lock.Unlock();
+}
+
+// Reads and compiles modmaps outside of the event loops and publishes the
+// results
+class cInputModmapLoader : protected cThread {
+private:
+	cInputDeviceController	&controller_;
+
+	cMutex			lock_;
+	cCondVar		cond_;
+	class SharedModmap	*jobs_[32];	// referenced
+	unsigned int		num_jobs_;
+
+	void		load(class SharedModmap *modmap);
+
+	cInputModmapLoader(cInputModmapLoader const &);
+	cInputModmapLoader & operator = (cInputModmapLoader const &);
+
+protected:
+	virtual void	Action(void);
+
+public:
+	explicit cInputModmapLoader(cInputDeviceController &controller);
+
+	bool		start(void) { return cThread::Start(); }
+	void		stop(void);
+	bool		queue(class SharedModmap *modmap);
+};
+
+cInputModmapLoader::cInputModmapLoader(cInputDeviceController &controller) :
+	controller_(controller), num_jobs_(0)
+{
+	SetDescription("inputdev modmap loader");
+}
+
+void cInputModmapLoader::stop(void)
+{
+	Cancel(-1);
+
+	lock_.Lock();
+	cond_.Broadcast();
+	lock_.Unlock();
+
+	Cancel(5);
+
+	while (num_jobs_ > 0)
+		controller_.put_modmap(jobs_[--num_jobs_]);
+}
+
+bool cInputModmapLoader::queue(class SharedModmap *modmap)
+{
+	bool		res = true;
+
+	// take the reference before 'lock_'; the controller might call us
+	// with its modmap lock held
+	modmap = controller_.ref_modmap(modmap);
+
+	lock_.Lock();
+
+	for (size_t i = 0; i < num_jobs_; ++i) {
+		if (jobs_[i] == modmap) {
+			// already pending
+			lock_.Unlock();
+			controller_.put_modmap(modmap);
+			return true;
+		}
+	}
+
+	if (num_jobs_ == ARRAY_SIZE(jobs_)) {
+		esyslog("%s: too much pending modmaps; skipping '%s'\n",
+			controller_.plugin_name(), modmap->get_fname());
+		res = false;
+	} else {
+		jobs_[num_jobs_++] = modmap;
+		modmap = NULL;
+		cond_.Broadcast();
+	}
+
+	lock_.Unlock();
+
+	controller_.put_modmap(modmap);
+	return res;
+}
+
+void cInputModmapLoader::load(class SharedModmap *shared)
+{
+	ModifierMap		modmap;
+	TranslationTable	*table;
+	char const		*fname = shared->get_fname();
+
+	if (fname != NULL &&
+	    !modmap.read_modmap(fname, controller_.get_cache_dir())) {
+		esyslog("%s: failed to load modmap '%s'\n",
+			controller_.plugin_name(), fname);
+		return;
+	}
+
+	table = new TranslationTable();
+	table->compile(modmap, cInputDevice::get_key_table());
+
+	// event loops might still use the old table; it is freed after they
+	// passed a quiescent point
+	controller_.retire(shared->replace_table(table));
+
+	isyslog("%s: loaded modmap '%s'\n", controller_.plugin_name(),
+		fname ? fname : "<builtin>");
+}
+
+void cInputModmapLoader::Action(void)
+{
+	while (Running()) {
+		class SharedModmap	*modmap;
+
+		lock_.Lock();
+		while (num_jobs_ == 0 && Running())
+			cond_.TimedWait(lock_, 1000);
+
+		if (num_jobs_ == 0) {
+			lock_.Unlock();
+			break;
+		}
+
+		modmap = jobs_[0];
+		--num_jobs_;
+		memmove(&jobs_[0], &jobs_[1], num_jobs_ * sizeof jobs_[0]);
+		lock_.Unlock();
+
+		load(modmap);
+		controller_.put_modmap(modmap);
+	}
+}
+
+// Modmap which has been assigned to a device path; kept independently of
+// the device so that the assignment can be done before the device is
+// plugged in
+class cModmapAssignment : public cListObject {
+public:
+	cString			dev_path;
+	class SharedModmap	*modmap;	// referenced; NULL for default
+
+	cModmapAssignment(char const *path) : dev_path(path), modmap(NULL) {}
+};
+
+// ===========================
+
+class cInputEventLoop : protected cThread {
+private:
+	cInputDeviceController	&controller_;
+	int			fd_epoll_;
+	int			fd_alive_[2];
+	class cEpollWakeup	wakeup_;
+
+	// number of attached devices; protected by the 'dev_mutex_' of the
+	// controller
+	unsigned int		num_devices_;
+
+	cInputEventLoop(cInputEventLoop const &);
+	cInputEventLoop & operator = (cInputEventLoop const &);
+
+protected:
+	virtual void	Action(void);
+
+public:
+	cInputEventLoop(cInputDeviceController &controller, unsigned int idx);
+	virtual ~cInputEventLoop();
+
+	bool		open(void);
+	bool		start(void);
+	void		stop(void);
+
+	int		get_fd(void) const { return fd_epoll_; }
+	void		wakeup(void) { wakeup_.kick(); }
+
+	unsigned int	get_load(void) const { return num_devices_; }
+	void		attach_device(void) { ++num_devices_; }
+	void		detach_device(void) { --num_devices_; }
+};
+
+static void dispatch_events(char const *name,
+			    struct epoll_event const events[], size_t cnt)
+{
+	for (size_t i = 0; i < cnt; ++i) {
+		unsigned int		ev = events[i].events;
+		class cEpollHandler	*dev =
+			static_cast<class cEpollHandler *>(events[i].data.ptr);
+
+		if (!dev)
+			esyslog("%s: internal error; got event from keep-alive pipe\n",
+				name);
+		else if ((ev & (EPOLLHUP|EPOLLIN)) == EPOLLHUP)
+			dev->handle_hup();
+		else if (ev & EPOLLIN)
+			dev->handle_pollin();
+		else
+			esyslog("%s: unexpected event %04x@%p\n",
+				name, ev, dev);
+	}
+}
+
+cInputEventLoop::cInputEventLoop(cInputDeviceController &controller,
+				 unsigned int idx) :
+	controller_(controller), fd_epoll_(-1), num_devices_(0)
+{
+	fd_alive_[0] = -1;
+	fd_alive_[1] = -1;
+
+	SetDescription("inputdev loop #%u", idx);
+}
+
+cInputEventLoop::~cInputEventLoop()
+{
+	controller_.close(fd_alive_[0]);
+	controller_.close(fd_alive_[1]);
+	controller_.close(fd_epoll_);
+}
+
+bool cInputEventLoop::open(void)
+{
+	struct epoll_event	ev = { };
+	int			rc;
+
+	fd_epoll_ = epoll_create1(EPOLL_CLOEXEC);
+	if (fd_epoll_ < 0) {
+		esyslog("%s: epoll_create1() failed: %s\n",
+			controller_.plugin_name(), strerror(errno));
+		goto err;
+	}
 
-	if (rc < 0 && errno == ENODEV) {
-		isyslog("%s: device '%s' removed\n",
-			controller_.plugin_name(), get_dev_path());
-		controller_.remove_device(this);
-		return;
+	rc = pipe2(fd_alive_, O_CLOEXEC);
+	if (rc < 0) {
+		esyslog("%s: pipe2(): %s\n", controller_.plugin_name(),
+			strerror(errno));
+		goto err;
 	}
 
+	ev.events   = EPOLLIN;
+	ev.data.ptr = NULL;
+	rc = epoll_ctl(fd_epoll_, EPOLL_CTL_ADD, fd_alive_[0], &ev);
 	if (rc < 0) {
-		esyslog("%s: failed to read from %s: %s\n",
-			controller_.plugin_name(), get_dev_path(),
+		esyslog("%s: epoll_ctl(ADD, <alive#%d>) failed: %s\n",
+			controller_.plugin_name(), fd_alive_[0],
 			strerror(errno));
-		return;
+		goto err;
 	}
 
-	if ((size_t)rc != sizeof ev) {
-		esyslog("%s: read unexpected amount %zd of data\n",
-			controller_.plugin_name(), rc);
-		return;
+	if (!wakeup_.open(fd_epoll_)) {
+		esyslog("%s: failed to create wakeup fd: %s\n",
+			controller_.plugin_name(), strerror(errno));
+		goto err;
 	}
 
-	// \todo: do something useful with the other events...
-	if (ev.type != EV_KEY)
-		// ignore events which are no valid key events
-		return;
+	return true;
 
-	if (quirks_.broken_repeat && !Time::is_null(repeat_rate_) &&
-	    ev.value == 1) {
-		if (last_key_val_ == ev.code &&
-		    Time::compare(next_key_tm_, ev.time) > 0) {
-			dsyslog("%s: %s received key too fast\n",
-				controller_.plugin_name(), get_dev_path());
+err:
+	controller_.close(fd_alive_[0]);
+	controller_.close(fd_alive_[1]);
+	controller_.close(fd_epoll_);
+	return false;
+}
 
-			// same key arrived faster than configured by
-			// EVIOCSREP; ignore it
-			return;
-		}
+bool cInputEventLoop::start(void)
+{
+	return cThread::Start();
+}
 
-		last_key_val_ = ev.code;
-		Time::add(next_key_tm_, ev.time, repeat_rate_);
-	}
+void cInputEventLoop::stop(void)
+{
+	Cancel(-1);
+	controller_.close(fd_alive_[1]);
+	Cancel(5);
+}
 
-	if (0)
-		dsyslog("%s: event{%s}=[%lu.%06u, %02x, %04x, %d]\n",
-			controller_.plugin_name(), get_dev_path(),
-			(unsigned long)(ev.time.tv_sec),
-			(unsigned int)(ev.time.tv_usec),
-			ev.type, ev.code, ev.value);
+void cInputEventLoop::Action(void)
+{
+	EpochDomain	&epoch = controller_.get_epoch();
 
-	if (magic_state_.process(ev)) {
-		isyslog("%s: magic keysequence from %s; detaching device\n",
-			controller_.plugin_name(), get_dev_path());
-		controller_.remove_device(this);
-		return;
-	}
+	controller_.apply_scheduling("event loop");
 
-	switch (ev.type) {
-	case EV_KEY: {
-		unsigned long	mask = 0;
-		wchar_t		c;
+	while (Running()) {
+		struct epoll_event	events[10];
+		int			rc;
 
-		is_valid = true;
+		{
+			// the read section covers epoll_wait() too; 'events'
+			// might refer to devices which are removed while
+			// waiting
+			EpochGuard	guard(epoch);
 
-		switch (ev.value) {
-		case 0:
-			is_released = true;
-			break;
-		case 1:
-			break;
-		case 2:
-			is_repeated = true;
-			break;
-		default:
-			is_valid = false;
-			break;
+			rc = epoll_wait(fd_epoll_, events, ARRAY_SIZE(events), -1);
+
+			if (!Running())
+				break;
+
+			if (rc < 0 && errno == EINTR)
+				continue;
+			else if (rc < 0) {
+				esyslog("%s: epoll_wait() failed: %s\n",
+					controller_.plugin_name(),
+					strerror(errno));
+				break;
+			}
+
+			dispatch_events(controller_.plugin_name(), events, rc);
 		}
 
-		switch (ev.code) {
-		case KEY_LEFTSHIFT:
-		case KEY_RIGHTSHIFT:
-			set_bit(ModifierMap::modSHIFT, &mask);
-			break;
+		// does not lock anything when no device has been removed
+		epoch.reclaim();
+	}
+}
 
-		case KEY_LEFTCTRL:
-		case KEY_RIGHTCTRL:
-			set_bit(ModifierMap::modCONTROL, &mask);
-			break;
+// Listens on the udev monitor netlink group and feeds 'input/event*' devices
+// which have a link in the coldplug directory into the device workers.
+// This avoids the fork/exec of the udev helper for each hotplug event.
+class cInputUeventListener : public cEpollHandler {
+private:
+	cInputDeviceController	&controller_;
+	int			fd_;
+	cString			link_prefix_;
 
-		case KEY_LEFTALT:
-		case KEY_RIGHTALT:
-			set_bit(ModifierMap::modALT, &mask);
-			break;
+	cInputUeventListener(cInputUeventListener const &);
+	cInputUeventListener & operator = (cInputUeventListener const &);
 
-		case KEY_LEFTMETA:
-		case KEY_RIGHTMETA:
-			set_bit(ModifierMap::modMETA, &mask);
-			break;
+	void		handle_uevent(Uevent const &ev);
 
-		case KEY_NUMLOCK:
-			set_bit(ModifierMap::modNUMLOCK, &mask);
-			break;
+public:
+	cInputUeventListener(cInputDeviceController &controller,
+			     char const *coldplug_dir) :
+		controller_(controller), fd_(-1),
+		link_prefix_(cString::sprintf("%s/", coldplug_dir)) {}
 
-		default:
-			break;
-		}
+	virtual ~cInputUeventListener() {
+		cInputDeviceController::close(fd_);
+	}
 
-		if (mask == 0) {
-			is_internal = false;
-		} else if (is_released) {
-			this->modifiers_ &= ~mask;
-			is_internal = true;
-		} else if (is_valid) {
- 			this->modifiers_ |=  mask;
-			is_internal = true;
-		} else {
-			// repeated events
-			is_internal = true;
-		}
+	bool		open(int efd);
 
-		if (is_internal) {
-			;		// noop
-		} else if (controller_.get_modmap().translate(
-				 c, ev.code, this->modifiers_)) {
-			code = wchar_t_to_ekey(c);
-			is_raw = true;
-		} else {
-			code = generate_code(0, ev.type, ev.code);
-			is_raw = false;
-		}
+	virtual void	handle_hup();
+	virtual void	handle_pollin();
+};
 
-		break;
+bool cInputUeventListener::open(int efd)
+{
+	struct sockaddr_nl	addr = { };
+	struct epoll_event	ev = { };
+	static int const	ONE = 1;
+	int			bufsz = 1024 * 1024;
+	int			rc;
+
+	fd_ = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+		     NETLINK_KOBJECT_UEVENT);
+	if (fd_ < 0) {
+		esyslog("%s: socket(NETLINK_KOBJECT_UEVENT) failed: %s\n",
+			controller_.plugin_name(), strerror(errno));
+		goto err;
 	}
 
-	default:
-		is_valid = false;
-		break;
+	// hotplug storms can generate many events; ignore errors
+	setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &bufsz, sizeof bufsz);
+
+	// required to verify the sender
+	rc = setsockopt(fd_, SOL_SOCKET, SO_PASSCRED, &ONE, sizeof ONE);
+	if (rc < 0) {
+		esyslog("%s: setsockopt(SO_PASSCRED) failed: %s\n",
+			controller_.plugin_name(), strerror(errno));
+		goto err;
 	}
 
-	if (is_internal)
-		return;
+	// events from udevd; they are sent after the device node and its
+	// links have been created
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = Uevent::GROUP_UDEV;
 
-	if (!is_valid) {
-		esyslog("%s: unexpected key events [%02x,%04x,%u]\n",
-			controller_.plugin_name(), ev.type, ev.code, ev.value);
-		return;
+	rc = bind(fd_, reinterpret_cast<struct sockaddr const *>(&addr),
+		  sizeof addr);
+	if (rc < 0) {
+		esyslog("%s: bind(<netlink>) failed: %s\n",
+			controller_.plugin_name(), strerror(errno));
+		goto err;
 	}
 
-	if (is_raw)
-		rc = controller_.PutRaw(code, is_repeated, is_released) ? 0 : -1;
-	else
-		rc = controller_.Put(code, is_repeated, is_released) ? 0 : -1;
+	ev.events   = EPOLLIN;
+	ev.data.ptr = static_cast<cEpollHandler *>(this);
 
+	rc = epoll_ctl(efd, EPOLL_CTL_ADD, fd_, &ev);
 	if (rc < 0) {
-		esyslog("%s: failed to put [%02x,%04x,%u] %sevent [%016" PRIX64 ", %d, %d]\n",
-			controller_.plugin_name(), ev.type, ev.code, ev.value,
-			is_raw ? "raw " : "",
-			code, is_repeated, is_released);
-		return;
+		esyslog("%s: epoll_ctl(ADD, <netlink>) failed: %s\n",
+			controller_.plugin_name(), strerror(errno));
+		goto err;
 	}
+
+	return true;
+
+err:
+	cInputDeviceController::close(fd_);
+	return false;
 }
 
-bool cInputDevice::set_repeat_rate(unsigned int delay_ms,
-				   unsigned int rate_ms)
+void cInputUeventListener::handle_hup(void)
 {
-	unsigned int	rep[2] = { delay_ms, rate_ms };
-	int		rc;
+	esyslog("%s: netlink socket hung up\n", controller_.plugin_name());
+}
 
-	if (!has_orig_repeate_rate()) {
-		dsyslog("%s: %s skipping setup of repeat rate because original one is unknown\n",
-			controller_.plugin_name(), get_dev_path());
-		return true;		// no error
-	}
+void cInputUeventListener::handle_uevent(Uevent const &ev)
+{
+	char const	*action = ev.get("ACTION");
+	char const	*subsystem = ev.get("SUBSYSTEM");
+	char const	*devname = ev.get("DEVNAME");
 
-	rc = ioctl(fd_, EVIOCSREP, rep);
-	if (rc < 0) {
-		esyslog("%s: %s failed to set repeat rate: %s\n",
-			controller_.plugin_name(), get_dev_path(),
-			strerror(errno));
+	if (!action || !subsystem || !devname ||
+	    strcmp(subsystem, "input") != 0)
+		return;
 
-		repeat_rate_.tv_sec  = 0;
-		repeat_rate_.tv_usec = 0;
+	// udevd sends absolute names while the kernel uses relative ones
+	if (strncmp(devname, "/dev/", 5) == 0)
+		devname += 5;
 
-		return false;
-	}
+	if (strncmp(devname, "input/event", 11) != 0)
+		return;
 
-	rc = ioctl(fd_, EVIOCGREP, rep);
-	if (rc >= 0) {
-		isyslog("%s: %s has repeat rate setting of [%u,%u]\n",
-			controller_.plugin_name(), get_dev_path(),
-			rep[0], rep[1]);
+	// only devices which have been selected for vdr by udev rules
+	if (!ev.has_prefix("DEVLINKS", link_prefix_))
+		return;
 
-		// todo: handle this as an error?
+	if (strcmp(action, "add") != 0 &&
+	    strcmp(action, "change") != 0 &&
+	    strcmp(action, "remove") != 0)
+		return;
 
-		rate_ms = rep[1];
-	}
+	controller_.queue_device_command(action, devname + 6);
+}
 
-	repeat_rate_.tv_sec  = (rate_ms / 1000);
-	repeat_rate_.tv_usec = (rate_ms % 1000) * 1000;
+void cInputUeventListener::handle_pollin(void)
+{
+	// drain the socket; events arrive in bursts while coldplugging
+	for (;;) {
+		char			buf[8192];
+		char			cbuf[CMSG_SPACE(sizeof(struct ucred))];
+		struct sockaddr_nl	addr;
+		struct iovec		iov = { buf, sizeof buf };
+		struct msghdr		msg = { };
+		struct cmsghdr		*cmsg;
+		struct ucred const	*cred = NULL;
+		Uevent			ev;
+		ssize_t			rc;
+
+		msg.msg_name       = &addr;
+		msg.msg_namelen    = sizeof addr;
+		msg.msg_iov        = &iov;
+		msg.msg_iovlen     = 1;
+		msg.msg_control    = cbuf;
+		msg.msg_controllen = sizeof cbuf;
+
+		rc = recvmsg(fd_, &msg, 0);
+		if (rc < 0 && errno == EINTR)
+			continue;
 
-	return true;
+		if (rc < 0 && errno == EAGAIN)
+			break;
+
+		if (rc < 0 && errno == ENOBUFS) {
+			esyslog("%s: netlink buffer overrun; events lost\n",
+				controller_.plugin_name());
+			continue;
+		}
+
+		if (rc < 0) {
+			esyslog("%s: recvmsg(<netlink>) failed: %s\n",
+				controller_.plugin_name(), strerror(errno));
+			break;
+		}
+
+		if (msg.msg_flags & MSG_TRUNC)
+			continue;
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET &&
+			    cmsg->cmsg_type == SCM_CREDENTIALS)
+				cred = reinterpret_cast<struct ucred const *>(
+					CMSG_DATA(cmsg));
+		}
+
+		// everybody can send to the multicast groups; accept only
+		// messages from root
+		if (!cred || cred->uid != 0) {
+			dsyslog("%s: ignoring uevent from unprivileged sender\n",
+				controller_.plugin_name());
+			continue;
+		}
+
+		if (!ev.parse(buf, rc)) {
+			dsyslog("%s: ignoring malformed uevent\n",
+				controller_.plugin_name());
+			continue;
+		}
+
+		handle_uevent(ev);
+	}
 }
 
 // ===========================
 
 cInputDeviceController::cInputDeviceController(cPlugin &p, ModifierMap &mod_map)
 	: cRemote("inputdev"), plugin_(p), mod_map_(mod_map),
-	  fd_udev_(-1), fd_epoll_(-1),
-	  repeat_delay_ms_(250), repeat_rate_ms_(100)
+	  default_modmap_(new SharedModmap(NULL)), modmaps_(NULL),
+	  modmap_loader_(new cInputModmapLoader(*this)),
+	  fd_udev_(-1), recv_buf_(NULL), recv_bufsz_(4096),
+	  fd_epoll_(-1), uevent_listener_(NULL),
+	  wakeup_(new cEpollWakeup()), repeater_(new cInputKeyRepeater(*this)),
+	  devices_(NULL), dev_index_(new cInputDeviceIndex()),
+	  dev_jobs_(new cInputDeviceJobs(*this)),
+	  profiles_(new DeviceProfileCache()),
+	  num_loops_(0), key_queue_(new KeyQueue()),
+	  key_delivery_(new cInputKeyDelivery(*this, *key_queue_)),
+	  repeat_delay_ms_(250), repeat_rate_ms_(100), hotkeys_(NULL),
+	  scancode_maps_(NULL), scheduling_(NULL)
 {
 	fd_alive_[0] = -1;
 	fd_alive_[1] = -1;
@@ -742,6 +2966,52 @@ cInputDeviceController::~cInputDeviceController(void)
 	this->close(fd_alive_[1]);
 	this->close(fd_udev_);
 	this->close(fd_epoll_);
+
+	// pending releases will wake up the loops
+	delete dev_jobs_;
+
+	for (size_t i = num_loops_; i > 0; --i)
+		delete loops_[i-1];
+
+	delete key_delivery_;
+
+	while (devices_) {
+		class cInputDevice	*dev = devices_;
+
+		devices_ = dev->next_device;
+		delete dev;
+	}
+
+	// no readers are active anymore
+	epoch_.reclaim();
+
+	// after the devices; they cancel their repeats on destruction
+	delete repeater_;
+
+	delete dev_index_;
+	delete profiles_;
+	delete wakeup_;
+	delete uevent_listener_;
+	delete [] recv_buf_;
+
+	for (;;) {
+		struct KeyEvent		key;
+
+		if (!key_queue_->pop(key))
+			break;
+
+		key.stats->unref();
+	}
+
+	delete key_queue_;
+	delete modmap_loader_;
+
+	for (cModmapAssignment *i = modmap_assignments_.First(); i;
+	     i = modmap_assignments_.Next(i))
+		put_modmap(i->modmap);
+
+	modmap_assignments_.Clear();
+	delete default_modmap_;
 }
 
 
@@ -808,6 +3078,26 @@ bool cInputDeviceController::open_generic(int fd_udev)
 		goto err;
 	}
 
+	if (!wakeup_->open(fd_epoll)) {
+		esyslog("%s: failed to create wakeup fd: %s\n",
+			plugin_.Name(), strerror(errno));
+		goto err;
+	}
+
+	if (!repeater_->open(fd_epoll)) {
+		esyslog("%s: failed to create repeat timer: %s\n",
+			plugin_.Name(), strerror(errno));
+		goto err;
+	}
+
+	{
+		// room for the queued datagrams of a trigger storm; ignore
+		// errors
+		int	sz = recv_bufsz_ * 16;
+
+		setsockopt(fd_udev, SOL_SOCKET, SO_RCVBUF, &sz, sizeof sz);
+	}
+
 	this->fd_udev_  = fd_udev;
 	this->fd_epoll_ = fd_epoll;
 
@@ -820,6 +3110,34 @@ err:
 	return false;
 }
 
+bool cInputDeviceController::open_netlink(char const *coldplug_dir)
+{
+	class cInputUeventListener	*listener;
+
+	if (fd_epoll_ < 0) {
+		esyslog("%s: internal error; netlink requires the udev socket\n",
+			plugin_.Name());
+		return false;
+	}
+
+	listener = new cInputUeventListener(*this, coldplug_dir);
+	if (!listener->open(fd_epoll_)) {
+		delete listener;
+		return false;
+	}
+
+	delete uevent_listener_;
+	uevent_listener_ = listener;
+
+	return true;
+}
+
+void cInputDeviceController::queue_device_command(char const *cmd,
+						  char const *dev)
+{
+	dev_jobs_->queue_command(cmd, dev);
+}
+
 bool cInputDeviceController::open_udev_socket(char const *sock_path)
 {
 	struct sockaddr_un	addr = { AF_UNIX };
@@ -883,20 +3201,49 @@ bool cInputDeviceController::open_udev_socket(unsigned int systemd_idx)
 
 #endif
 
-void cInputDeviceController::cleanup_devices(void)
+int cInputDeviceController::get_epoll_fd(class cInputDevice const *dev) const
 {
-	dev_mutex_.Lock();
-	while (gc_devices_.Count() > 0) {
-		class cInputDevice *dev = gc_devices_.First();
+	class cInputEventLoop const	*loop = dev->get_loop();
 
-		assert(dev->container == &gc_devices_);
-		gc_devices_.Del(dev, false);
+	return loop ? loop->get_fd() : fd_epoll_;
+}
 
-		dev_mutex_.Unlock();
-		delete dev;
-		dev_mutex_.Lock();
+class cInputEventLoop *cInputDeviceController::select_loop(void)
+{
+	class cInputEventLoop	*res = NULL;
+
+	for (size_t i = 0; i < num_loops_; ++i) {
+		if (!res || loops_[i]->get_load() < res->get_load())
+			res = loops_[i];
 	}
-	dev_mutex_.Unlock();
+
+	if (res)
+		res->attach_device();
+
+	return res;
+}
+
+bool cInputDeviceController::set_num_loops(unsigned int cnt)
+{
+	if (cnt > ARRAY_SIZE(loops_)) {
+		esyslog("%s: too much event loops (%u > %zu)\n",
+			plugin_name(), cnt, ARRAY_SIZE(loops_));
+		return false;
+	}
+
+	while (num_loops_ < cnt) {
+		class cInputEventLoop	*loop =
+			new cInputEventLoop(*this, num_loops_);
+
+		if (!loop->open()) {
+			delete loop;
+			return false;
+		}
+
+		loops_[num_loops_++] = loop;
+	}
+
+	return true;
 }
 
 void cInputDeviceController::handle_hup(void)
@@ -906,77 +3253,95 @@ void cInputDeviceController::handle_hup(void)
 	this->Cancel(-1);
 }
 
+void cInputDeviceController::apply_scheduling(char const *thread) const
+{
+	if (scheduling_)
+		scheduling_->apply(plugin_name(), thread);
+}
+
 void cInputDeviceController::Action(void)
 {
+	// the hotplug socket and the soft key repeater are served by this
+	// thread; without additional loops (--threads=0), the devices too
+	apply_scheduling("event handler");
+
 	while (Running()) {
 		struct epoll_event	events[10];
 		int			rc;
-		size_t			i;
 
-		rc = epoll_wait(fd_epoll_, events,
-				sizeof events/sizeof events[0], -1);
+		{
+			// see cInputEventLoop::Action()
+			EpochGuard	guard(epoch_);
 
-		if (!Running())
-			break;
+			rc = epoll_wait(fd_epoll_, events, ARRAY_SIZE(events), -1);
 
-		if (rc < 0 && errno == EINTR)
-			continue;
-		else if (rc < 0) {
-			esyslog("%s: epoll_wait() failed: %s\n", plugin_.Name(),
-				strerror(errno));
-			break;
-		}
+			if (!Running())
+				break;
 
-		for (i = 0; i < (size_t)(rc); ++i) {
-			unsigned int		ev = events[i].events;
-			class cEpollHandler	*dev =
-				static_cast<class cEpollHandler *>(events[i].data.ptr);
-
-			if (!dev)
-				esyslog("%s: internal error; got event from keep-alive pipe\n",
-					plugin_.Name());
-			else if ((ev & (EPOLLHUP|EPOLLIN)) == EPOLLHUP)
-				dev->handle_hup();
-			else if (ev & EPOLLIN)
-				dev->handle_pollin();
-			else
-				esyslog("%s: unexpected event %04x@%p\n",
-					plugin_.Name(), ev, dev);
+			if (rc < 0 && errno == EINTR)
+				continue;
+			else if (rc < 0) {
+				esyslog("%s: epoll_wait() failed: %s\n",
+					plugin_.Name(), strerror(errno));
+				break;
+			}
+
+			dispatch_events(plugin_.Name(), events, rc);
 		}
 
-		cleanup_devices();
+		epoch_.reclaim();
 	}
 }
 
+void cInputDeviceController::wakeup_loops(void)
+{
+	for (size_t i = 0; i < num_loops_; ++i)
+		loops_[i]->wakeup();
+
+	wakeup_->kick();
+}
+
+void cInputDeviceController::retire(EpochObject *obj)
+{
+	if (!obj)
+		return;
+
+	epoch_.retire(obj);
+	wakeup_loops();
+}
+
 class cInputDevice *cInputDeviceController::find_by_path(char const *path)
 {
-	class cInputDevice	*dev = NULL;
+	class cInputDevice	*dev;
 	struct stat		st;
 
+	// the common case is that udev uses the same name for adding and
+	// removing the device
+	dev = dev_index_->find(path);
+	if (dev)
+		return dev;
+
+	// device might have been registered under a different name (e.g. a
+	// symlink in the coldplug directory)
 	if (stat(path, &st) < 0) {
-		dsyslog("%s: fstat(%s) failed: %s\n", plugin_name(),
+		dsyslog("%s: stat(%s) failed: %s\n", plugin_name(),
 			path, strerror(errno));
-	} else {
-		for (cInputDevice *i = devices_.First();
-		     i != NULL && dev == NULL;
-		     i = devices_.Next(i)) {
-			if (i->Compare(st.st_rdev) == 0)
-				dev = i;
-		}
+		return NULL;
 	}
 
-	return dev;
+	return dev_index_->find(st.st_rdev);
 }
 
-void cInputDeviceController::change_quirk(char const *dev_path,
+void cInputDeviceController::change_quirk(char const *dev_name,
 					  char const *quirk)
 {
-	cMutexLock		lock(&dev_mutex_);
+	cString			dev_path = get_dev_path(dev_name);
+	EpochGuard		guard(epoch_);
 	class cInputDevice	*dev = find_by_path(dev_path);
 
 	if (!dev) {
 		esyslog("%s: device '%s' not found\n",
-			plugin_name(), dev_path);
+			plugin_name(), *dev_path);
 	} else {
 		bool	do_set;
 
@@ -998,43 +3363,82 @@ void cInputDeviceController::change_quirk(char const *dev_path,
 	}
 }
 
-void cInputDeviceController::remove_device(char const *dev_path)
+void cInputDeviceController::change_key_policy(char const *dev_name,
+						char const *spec)
+{
+	cString			dev_path = get_dev_path(dev_name);
+	EpochGuard		guard(epoch_);
+	class cInputDevice	*dev = find_by_path(dev_path);
+
+	if (!dev)
+		esyslog("%s: device '%s' not found\n",
+			plugin_name(), *dev_path);
+	else
+		dev->change_key_policy(spec);
+}
+
+void cInputDeviceController::change_rel_threshold(char const *dev_name,
+						   char const *spec)
+{
+	cString			dev_path = get_dev_path(dev_name);
+	EpochGuard		guard(epoch_);
+	class cInputDevice	*dev = find_by_path(dev_path);
+
+	if (!dev)
+		esyslog("%s: device '%s' not found\n",
+			plugin_name(), *dev_path);
+	else
+		dev->change_rel_threshold(spec);
+}
+
+void cInputDeviceController::remove_device(char const *dev_name)
 {
+	cString			dev_path = get_dev_path(dev_name);
 	cMutexLock		lock(&dev_mutex_);
 	class cInputDevice	*dev = find_by_path(dev_path);
 
 	if (!dev) {
 		esyslog("%s: device '%s' not found\n",
-			plugin_name(), dev_path);
+			plugin_name(), *dev_path);
 	} else {
-		dev->stop(fd_epoll_);
-
-		assert(dev->container == &devices_);
-		devices_.Del(dev, false);
-
-		gc_devices_.Add(dev);
-		dev->container = &gc_devices_;
+		remove_device(dev);
 	}
 }
 
 void cInputDeviceController::remove_device(class cInputDevice *dev)
 {
 	cMutexLock		lock(&dev_mutex_);
+	class cInputDevice	**ptr;
+
+	if (dev->is_removed)
+		// device has been removed already by another thread
+		return;
+
+	dev->is_removed = true;
+	dev->stop(get_epoll_fd(dev));
+
+	if (dev->get_loop())
+		dev->get_loop()->detach_device();
+
+	dev_index_->remove(dev);
 
-	dev->stop(fd_epoll_);
+	for (ptr = &devices_; *ptr != dev; ptr = &(*ptr)->next_device)
+		assert(*ptr != NULL);
 
-	if (dev->container)
-		dev->container->Del(dev, false);
+	// 'next_device' is kept for concurrent readers
+	__atomic_store_n(ptr, dev->next_device, __ATOMIC_RELEASE);
 
-	gc_devices_.Add(dev);
-	dev->container = &gc_devices_;
+	repeater_->cancel(dev);
+
+	// restoring the device settings might block; the worker retires the
+	// device afterwards
+	dev_jobs_->queue_release(dev);
 }
 
 bool cInputDeviceController::add_device(char const *dev_name)
 {
 	class cInputDevice	*dev =
-		new cInputDevice(*this,
-				 cString::sprintf("/dev/input/%s", dev_name));
+		new cInputDevice(*this, get_dev_path(dev_name));
 	char const		*desc;
 	bool			res;
 
@@ -1045,34 +3449,57 @@ bool cInputDeviceController::add_device(char const *dev_name)
 
 	desc = dev->get_description();
 
-	cMutexLock		lock(&dev_mutex_);
+	dev_mutex_.Lock();
+	res = dev_index_->find(dev->get_dev_t()) == NULL;
+	dev_mutex_.Unlock();
 
-	for (cInputDevice *i = devices_.First(); i; i = devices_.Next(i)) {
-		if (dev->Compare(*i) == 0) {
-			dsyslog("%s: device '%s' (%s) already registered\n",
-				plugin_name(), dev_name, desc);
-			delete dev;
-			dev = NULL;
-			break;
-		}
+	if (!res) {
+		dsyslog("%s: device '%s' (%s) already registered\n",
+			plugin_name(), dev_name, desc);
+		delete dev;
+		return false;
+	}
+
+	dev->set_modmap(find_assigned_modmap(dev->get_dev_path()));
+
+	// this is done without holding 'dev_mutex_'; the ioctls might block
+	// and the device is not visible to other threads yet
+	res = dev->start();
+
+	if (!res) {
+		// device has not been grabbed; no release() necessary
+		delete dev;
+		return false;
 	}
 
-	if (dev != NULL) {
-		isyslog("%s: added input device '%s' (%s)\n",
+	cMutexLock		lock(&dev_mutex_);
+
+	// the device might have been added concurrently under a different
+	// name
+	if (dev_index_->find(dev->get_dev_t()) != NULL) {
+		dsyslog("%s: device '%s' (%s) already registered\n",
 			plugin_name(), dev_name, desc);
-		devices_.Add(dev);
-		dev->container = &devices_;
+		dev->release();
+		delete dev;
+		return false;
 	}
 
-	if (dev == NULL) {
-		res = false;
-	} else if (!dev->start(fd_epoll_)) {
-		res = false;
+	isyslog("%s: added input device '%s' (%s)\n",
+		plugin_name(), dev_name, desc);
+	dev->next_device = devices_;
+	__atomic_store_n(&devices_, dev, __ATOMIC_RELEASE);
+	dev_index_->add(dev);
+	dev->set_loop(select_loop());
+
+	// after linking and under 'dev_mutex_'; a concurrent
+	// set_repeat_rate() either sees the device or has stored its rates
+	// already
+	dev->set_repeat_rate(get_repeat_delay(), get_repeat_rate());
+
+	// handing the device over to the event loop is the last step
+	res = dev->attach(get_epoll_fd(dev));
+	if (!res)
 		remove_device(dev);
-	} else {
-		dev->set_repeat_rate(repeat_delay_ms_, repeat_rate_ms_);
-		res = true;
-	}
 
 	return res;
 }
@@ -1083,7 +3510,7 @@ bool cInputDeviceController::set_repeat_rate(unsigned int delay_ms,
 	bool		success = true;
 
 	cMutexLock	lock(&dev_mutex_);
-	for (cInputDevice *i = devices_.First(); i; i = devices_.Next(i))
+	for (cInputDevice *i = devices_; i; i = i->next_device)
 		success &= i->set_repeat_rate(delay_ms, rate_ms);
 
 	if (!success) {
@@ -1093,8 +3520,8 @@ bool cInputDeviceController::set_repeat_rate(unsigned int delay_ms,
 	} else {
 		isyslog("%s: set repeat parameters  [%u, %u]\n",
 			plugin_name(), delay_ms, rate_ms);
-		repeat_delay_ms_ = delay_ms;
-		repeat_rate_ms_  = rate_ms;
+		__atomic_store_n(&repeat_delay_ms_, delay_ms, __ATOMIC_RELAXED);
+		__atomic_store_n(&repeat_rate_ms_,  rate_ms,  __ATOMIC_RELAXED);
 	}
 
 	return success;
@@ -1103,60 +3530,297 @@ bool cInputDeviceController::set_repeat_rate(unsigned int delay_ms,
 
 void cInputDeviceController::dump_active_devices(void)
 {
-	cMutexLock	lock(&dev_mutex_);
+	EpochGuard	guard(epoch_);
 
 	dsyslog("%s: active devices:\n", plugin_name());
-	for (cInputDevice *i = devices_.First(); i; i = devices_.Next(i))
+	for (cInputDevice *i = __atomic_load_n(&devices_, __ATOMIC_ACQUIRE);
+	     i != NULL;
+	     i = __atomic_load_n(&i->next_device, __ATOMIC_ACQUIRE))
 		i->dump();
 }
 
-void cInputDeviceController::dump_gc_devices(void)
+cString cInputDeviceController::get_stats(void)
 {
-	cMutexLock	lock(&dev_mutex_);
+	EpochGuard	guard(epoch_);
+	struct timespec	now;
+	int64_t		now_us;
+	cString		res;
 
-	dsyslog("%s: gc devices:\n", plugin_name());
-	for (cInputDevice *i = gc_devices_.First(); i; i = gc_devices_.Next(i))
-		i->dump();
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	now_us = now.tv_sec * 1000000ll + now.tv_nsec / 1000;
+
+	res = cString::sprintf("queue used=%u/%u max=%u dropped=%lu",
+			       key_queue_->get_occupancy(), KeyQueue::CAPACITY,
+			       key_queue_->get_max_occupancy(),
+			       key_queue_->get_num_dropped());
+
+	for (cInputDevice *i = __atomic_load_n(&devices_, __ATOMIC_ACQUIRE);
+	     i != NULL;
+	     i = __atomic_load_n(&i->next_device, __ATOMIC_ACQUIRE))
+		res = cString::sprintf("%s\n%s", *res, *i->format_stats(now_us));
+
+	return res;
 }
 
-void cInputDeviceController::handle_pollin(void)
+void cInputDeviceController::log_stats(void)
 {
-	char		buf[128];
-	char		cmd[sizeof buf];
-	char		dev[sizeof buf];
+	cString		stats = get_stats();
+	char		*next;
 
-	ssize_t		rc;
+	for (char *line = strtok_r(const_cast<char *>(*stats), "\n", &next);
+	     line != NULL; line = strtok_r(NULL, "\n", &next))
+		isyslog("%s: %s\n", plugin_name(), line);
+}
 
-	rc = read(fd_udev_, buf, sizeof buf - 1u);
-	if (rc < 0 && errno == EINTR)
-		return;
+void cInputDeviceController::dump_queue(void)
+{
+	dsyslog("%s: key queue: %u/%u used, max %u, %lu dropped\n",
+		plugin_name(), key_queue_->get_occupancy(), KeyQueue::CAPACITY,
+		key_queue_->get_max_occupancy(), key_queue_->get_num_dropped());
+}
 
-	if (rc < 0) {
-		esyslog("%s: read(<udev>) failed: %s\n", plugin_.Name(),
-			strerror(errno));
+void cInputDeviceController::set_modmap_fname(char const *fname)
+{
+	// must be called before initialize(); no device uses the table yet
+	delete default_modmap_;
+	default_modmap_ = new SharedModmap(fname && fname[0] ? fname : NULL);
+}
+
+void cInputDeviceController::set_cache_dir(char const *dir)
+{
+	cache_dir_ = dir;
+}
+
+TranslationTable const *cInputDeviceController::get_translation(void) const
+{
+	return default_modmap_->get_table();
+}
+
+class SharedModmap *cInputDeviceController::ref_modmap(class SharedModmap *modmap)
+{
+	cMutexLock	lock(&modmap_mutex_);
+
+	if (modmap && modmap != default_modmap_)
+		++modmap->refcnt;
+
+	return modmap;
+}
+
+void cInputDeviceController::put_modmap(class SharedModmap *modmap)
+{
+	class SharedModmap	**ptr;
+
+	if (!modmap || modmap == default_modmap_)
 		return;
+
+	modmap_mutex_.Lock();
+	assert(modmap->refcnt > 0);
+	if (--modmap->refcnt > 0) {
+		modmap = NULL;
+	} else {
+		for (ptr = &modmaps_; *ptr != modmap; ptr = &(*ptr)->next)
+			assert(*ptr != NULL);
+
+		*ptr = modmap->next;
 	}
+	modmap_mutex_.Unlock();
 
-	if (rc == sizeof buf - 1u) {
-		esyslog("%s: read(<udev>) received too much data\n",
-			plugin_.Name());
-		return;
+	// devices might still use the modmap in their current event batch
+	if (modmap)
+		retire(modmap);
+}
+
+class SharedModmap *cInputDeviceController::get_modmap(char const *fname)
+{
+	char			*path = realpath(fname, NULL);
+	class SharedModmap	*modmap;
+	bool			is_new = false;
+
+	if (!path) {
+		esyslog("%s: bad modmap '%s': %s\n", plugin_name(),
+			fname, strerror(errno));
+		return NULL;
 	}
 
-	buf[rc] = '\0';
-	rc = sscanf(buf, "%s %s", cmd, dev);
-	if (rc != 2) {
-		esyslog("%s: invalid uevent '%s'\n", plugin_.Name(), buf);
-		return;
+	modmap_mutex_.Lock();
+	for (modmap = modmaps_; modmap; modmap = modmap->next) {
+		if (strcmp(modmap->get_fname(), path) == 0)
+			break;
+	}
+
+	if (!modmap) {
+		modmap = new SharedModmap(path);
+		modmap->next = modmaps_;
+		modmaps_ = modmap;
+		is_new = true;
+	}
+
+	++modmap->refcnt;
+	modmap_mutex_.Unlock();
+
+	free(path);
+
+	if (is_new)
+		modmap_loader_->queue(modmap);
+
+	return modmap;
+}
+
+void cInputDeviceController::assign_modmap(char const *dev_name,
+					   char const *fname)
+{
+	cString			dev_path = get_dev_path(dev_name);
+	class SharedModmap	*modmap = NULL;
+	cModmapAssignment	*assignment;
+	class cInputDevice	*dev;
+
+	if (strcmp(fname, "-") != 0 && strcasecmp(fname, "default") != 0) {
+		modmap = get_modmap(fname);
+		if (!modmap)
+			return;
+	}
+
+	cMutexLock		lock(&dev_mutex_);
+
+	for (assignment = modmap_assignments_.First(); assignment;
+	     assignment = modmap_assignments_.Next(assignment)) {
+		if (strcmp(assignment->dev_path, dev_path) == 0)
+			break;
+	}
+
+	if (!assignment) {
+		assignment = new cModmapAssignment(dev_path);
+		modmap_assignments_.Add(assignment);
 	}
 
+	put_modmap(assignment->modmap);
+	assignment->modmap = modmap;
+
+	dev = find_by_path(dev_path);
+	if (dev)
+		put_modmap(dev->set_modmap(ref_modmap(modmap)));
+
+	isyslog("%s: assigned modmap '%s' to %s\n", plugin_name(),
+		modmap ? modmap->get_fname() : "<default>", *dev_path);
+}
+
+class SharedModmap *cInputDeviceController::find_assigned_modmap(char const *dev_path)
+{
+	cMutexLock		lock(&dev_mutex_);
+
+	for (cModmapAssignment *i = modmap_assignments_.First(); i;
+	     i = modmap_assignments_.Next(i)) {
+		if (strcmp(i->dev_path, dev_path) == 0)
+			return ref_modmap(i->modmap);
+	}
+
+	return NULL;
+}
+
+cString cInputDeviceController::get_dev_path(char const *dev_name)
+{
+	if (dev_name[0] == '/')
+		return dev_name;
+	else
+		return cString::sprintf("/dev/input/%s", dev_name);
+}
+
+void cInputDeviceController::reload_modmap(void)
+{
+	modmap_loader_->queue(default_modmap_);
+
+	cMutexLock	lock(&modmap_mutex_);
+	for (class SharedModmap *i = modmaps_; i; i = i->next)
+		modmap_loader_->queue(i);
+}
+
+bool cInputDeviceController::queue_key(struct KeyEvent const &key)
+{
+	return key_queue_->push(key);
+}
+
+void cInputDeviceController::dump_gc_devices(void)
+{
+	dsyslog("%s: gc: %u retired objects waiting for readers\n",
+		plugin_name(), epoch_.get_num_retired());
+}
+
+bool cInputDeviceController::is_device_command(char const *cmd)
+{
+	return (strcasecmp(cmd, "add") == 0 ||
+		strcasecmp(cmd, "change") == 0 ||
+		strcasecmp(cmd, "remove") == 0 ||
+		strncasecmp(cmd, "quirk:", 6) == 0 ||
+		strncasecmp(cmd, "keypolicy:", 10) == 0 ||
+		strncasecmp(cmd, "relthreshold:", 13) == 0 ||
+		strncasecmp(cmd, "modmap:", 7) == 0);
+}
+
+bool cInputDeviceController::run_device_command(char const *cmd,
+						char const *dev)
+{
+	bool	res = true;
+
 	if (strcasecmp(cmd, "add") == 0 ||
 	    strcasecmp(cmd, "change") == 0) {
-		add_device(dev);
+		res = add_device(dev);
 	} else if (strcasecmp(cmd, "remove") == 0) {
 		remove_device(dev);
 	} else if (strncasecmp(cmd, "quirk:", 6) == 0) {
 		change_quirk(dev, cmd+6);
+	} else if (strncasecmp(cmd, "keypolicy:", 10) == 0) {
+		change_key_policy(dev, cmd+10);
+	} else if (strncasecmp(cmd, "relthreshold:", 13) == 0) {
+		change_rel_threshold(dev, cmd+13);
+	} else if (strncasecmp(cmd, "modmap:", 7) == 0) {
+		assign_modmap(dev, cmd+7);
+	} else {
+		esyslog("%s: invalid command '%s' for '%s'\n", plugin_name(),
+			cmd, dev);
+		res = false;
+	}
+
+	return res;
+}
+
+void cInputDeviceController::set_recv_bufsize(size_t sz)
+{
+	// maximum datagram size; smaller values would reject the single
+	// commands of the udev helper
+	recv_bufsz_ = std::max(sz, static_cast<size_t>(128));
+}
+
+void cInputDeviceController::handle_command(char *line)
+{
+	char		*cmd;
+	char		*dev;
+	char		*next;
+
+	cmd = strtok_r(line, " \t", &next);
+	if (!cmd)
+		// empty line
+		return;
+
+	dev = strtok_r(NULL, " \t", &next);
+	if (!dev) {
+		esyslog("%s: invalid uevent '%s'; no device given\n",
+			plugin_.Name(), cmd);
+		return;
+	}
+
+	// 'line' has been split by strtok_r() already; log the parts
+	next += strspn(next, " \t");
+	if (*next != '\0') {
+		esyslog("%s: invalid uevent '%s %s %s'; too many arguments\n",
+			plugin_.Name(), cmd, dev, next);
+		return;
+	}
+
+	if (is_device_command(cmd)) {
+		dev_jobs_->queue_command(cmd, dev);
+	} else if (strcasecmp(cmd, "reload") == 0 &&
+		   strcasecmp(dev, "modmap") == 0) {
+		reload_modmap();
 	} else if (strcasecmp(cmd, "dump") == 0) {
 		bool	is_all = strcasecmp(dev, "all") == 0;
 		if (is_all || strcasecmp(dev, "active") == 0)
@@ -1164,6 +3828,9 @@ void cInputDeviceController::handle_pollin(void)
 
 		if (is_all || strcasecmp(dev, "gc") == 0)
 			dump_gc_devices();
+
+		if (is_all || strcasecmp(dev, "queue") == 0)
+			dump_queue();
 	} else {
 		esyslog("%s: invalid command '%s' for '%s'\n", plugin_name(),
 			cmd, dev);
@@ -1171,10 +3838,100 @@ void cInputDeviceController::handle_pollin(void)
 	}
 }
 
-bool cInputDeviceController::coldplug_devices(char const *path)
+void cInputDeviceController::execute_command(char const *cmd)
+{
+	char	*tmp = strdup(cmd);
+
+	if (tmp) {
+		handle_command(tmp);
+		free(tmp);
+	}
+}
+
+void cInputDeviceController::handle_message(char *buf, size_t len)
+{
+	char		*line = buf;
+
+	buf[len] = '\0';
+
+	// a datagram contains one or more newline separated commands
+	while (line < buf + len) {
+		char	*eol = strchr(line, '\n');
+
+		if (eol)
+			*eol = '\0';
+
+		handle_command(line);
+
+		if (!eol)
+			break;
+
+		line = eol + 1;
+	}
+}
+
+void cInputDeviceController::handle_pollin(void)
+{
+	// number of datagrams which are read by one recvmmsg() call
+	static size_t const	BATCH = 16;
+
+	struct mmsghdr		msgs[BATCH];
+	struct iovec		iov[BATCH];
+	int			rc;
+
+	// each slot has an extra byte for the terminating NUL so that
+	// datagrams of exactly 'recv_bufsz_' bytes are accepted
+	if (!recv_buf_)
+		recv_buf_ = new char[BATCH * (recv_bufsz_ + 1u)];
+
+	for (size_t i = 0; i < BATCH; ++i) {
+		iov[i].iov_base = recv_buf_ + i * (recv_bufsz_ + 1u);
+		iov[i].iov_len  = recv_bufsz_;
+	}
+
+	// drain the socket; trigger storms queue up many datagrams
+	for (;;) {
+		memset(msgs, 0, sizeof msgs);
+		for (size_t i = 0; i < BATCH; ++i) {
+			msgs[i].msg_hdr.msg_iov    = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		rc = recvmmsg(fd_udev_, msgs, BATCH, MSG_DONTWAIT, NULL);
+		if (rc < 0 && errno == EINTR)
+			// retry
+			continue;
+
+		if (rc < 0 && errno == EAGAIN)
+			break;
+
+		if (rc < 0) {
+			esyslog("%s: recvmmsg(<udev>) failed: %s\n",
+				plugin_.Name(), strerror(errno));
+			break;
+		}
+
+		for (int i = 0; i < rc; ++i) {
+			if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+				esyslog("%s: read(<udev>) received more than %zu bytes; datagram dropped\n",
+					plugin_.Name(), recv_bufsz_);
+				continue;
+			}
+
+			handle_message(static_cast<char *>(iov[i].iov_base),
+				       msgs[i].msg_len);
+		}
+
+		if (rc < static_cast<int>(BATCH))
+			// socket is empty
+			break;
+	}
+}
+
+unsigned int cInputDeviceController::queue_coldplug(char const *path)
 {
 	cReadDir		cdir(path);
-	bool			res = true;
+	unsigned int		cnt = 0;
 
 	for (;;) {
 		struct dirent const	*ent = cdir.Next();
@@ -1186,23 +3943,59 @@ bool cInputDeviceController::coldplug_devices(char const *path)
 		    strcmp(ent->d_name, "..") == 0)
 			continue;
 
-		if (!add_device(ent->d_name)) {
-			esyslog("%s: failed to coldplug '%s'\n",
-				plugin_name(), ent->d_name);
-			res = false;
-		} else {
-			isyslog("%s: coldplugged '%s'\n",
-				plugin_name(), ent->d_name);
-		}
+		dev_jobs_->queue_command("add", ent->d_name);
+		++cnt;
 	}
 
-	return res;
+	return cnt;
+}
+
+void cInputDeviceController::reattach_devices(void)
+{
+	// devices which are registered already are skipped by add_device()
+	queue_coldplug(coldplug_dir_);
+}
+
+bool cInputDeviceController::coldplug_devices(char const *path)
+{
+	unsigned int		cnt = queue_coldplug(path);
+	unsigned int		num_failed;
+
+	// devices are brought up in parallel; startup takes as long as the
+	// slowest one.  Failures have been logged by add_device() already.
+	num_failed = dev_jobs_->wait_idle();
+
+	isyslog("%s: coldplugged %u devices from '%s'\n", plugin_name(),
+		cnt - std::min(cnt, num_failed), path);
+
+	if (num_failed > 0)
+		esyslog("%s: failed to coldplug %u devices\n", plugin_name(),
+			num_failed);
+
+	return num_failed == 0;
 }
 
 bool cInputDeviceController::initialize(char const *coldplug_dir)
 {
+	if (!key_queue_->open()) {
+		esyslog("%s: failed to create key queue: %s\n",
+			plugin_name(), strerror(errno));
+		return false;
+	}
+
 	cInputDevice::install_keymap(Name());
 
+	{
+		TranslationTable	*table = new TranslationTable();
+
+		table->compile(mod_map_, cInputDevice::get_key_table());
+		delete default_modmap_->replace_table(table);
+	}
+
+	profiles_->load();
+
+	coldplug_dir_ = coldplug_dir;
+	dev_jobs_->start();
 	coldplug_devices(coldplug_dir);
 
 	return true;
@@ -1210,16 +4003,32 @@ bool cInputDeviceController::initialize(char const *coldplug_dir)
 
 bool cInputDeviceController::start(void)
 {
+	key_delivery_->start();
+	modmap_loader_->start();
+
+	for (size_t i = 0; i < num_loops_; ++i)
+		loops_[i]->start();
+
 	cThread::Start();
 	return true;
 }
 
 void cInputDeviceController::stop(void)
 {
+	// workers might still add devices and register them at 'fd_epoll_'
+	// or at the loops; later commands are executed inline
+	dev_jobs_->stop();
+
+	for (size_t i = 0; i < num_loops_; ++i)
+		loops_[i]->stop();
+
 	Cancel(-1);
+	this->close(fd_alive_[1]);
+	Cancel(5);
 
+	// the thread does not wait on it anymore
 	this->close(fd_epoll_);
-	this->close(fd_alive_[1]);
 
-	Cancel(5);
+	key_delivery_->stop();
+	modmap_loader_->stop();
 }
@@ -20,6 +20,8 @@
 #include <vdr/remote.h>
 #include <vdr/thread.h>
 
+#include "epoch.h"
+
 class cEpollHandler {
 public:
 	virtual ~cEpollHandler() {}
@@ -29,37 +31,114 @@ public:
 };
 
 class ModifierMap;
+class TranslationTable;
 class cPlugin;
 class cInputDevice;
+class cInputDeviceIndex;
+class cEpollWakeup;
+class cInputKeyRepeater;
+class cInputUeventListener;
+class cInputDeviceJobs;
+class DeviceProfileCache;
+class cInputEventLoop;
+class cInputKeyDelivery;
+class cInputModmapLoader;
+class cModmapAssignment;
+class SharedModmap;
+class KeyQueue;
+class SequenceMatcher;
+class ScancodeMapSet;
+class ThreadScheduling;
+struct KeyEvent;
 class cInputDeviceController : protected cRemote, protected cThread,
 			       protected cEpollHandler
 {
 private:
 	cPlugin			&plugin_;
 	ModifierMap		&mod_map_;
+	cString			cache_dir_;
+
+	// the modmap given by '--modmap' and the ones which are assigned to
+	// single devices; the latter are shared when they refer to the same
+	// file
+	class SharedModmap	*default_modmap_;
+	class SharedModmap	*modmaps_;
+	cMutex			modmap_mutex_;
+	cList<cModmapAssignment>	modmap_assignments_;
+	class cInputModmapLoader	*modmap_loader_;
+
+	EpochDomain		epoch_;
 	int			fd_udev_;
+	char			*recv_buf_;
+	size_t			recv_bufsz_;
 	int			fd_epoll_;
 	int			fd_alive_[2];
-	cList<cInputDevice>	devices_;
-	cList<cInputDevice>	gc_devices_;
+	class cInputUeventListener	*uevent_listener_;
+	class cEpollWakeup	*wakeup_;
+
+	// generates the repeats of devices with the 'soft_repeat' quirk
+	class cInputKeyRepeater	*repeater_;
+
+	// registered devices; readers walk the list under an EpochGuard, it is
+	// modified with 'dev_mutex_' held.  Removed devices are retired in
+	// 'epoch_'.
+	class cInputDevice	*devices_;
+
+	// lookup of the devices in 'devices_' by dev_t and path
+	class cInputDeviceIndex	*dev_index_;
+
+	// workers which bring up and release devices
+	class cInputDeviceJobs	*dev_jobs_;
+
+	// known devices; persisted in the config directory
+	class DeviceProfileCache	*profiles_;
 
 	cMutex			dev_mutex_;
 
+	// optional additional event loops for the devices; the udev socket
+	// is always handled by the controller thread
+	class cInputEventLoop	*loops_[16];
+	unsigned int		num_loops_;
+
+	// keys are handed over from the device handlers to the delivery
+	// thread which feeds them into cRemote
+	KeyQueue		*key_queue_;
+	class cInputKeyDelivery	*key_delivery_;
+
 	unsigned int		repeat_delay_ms_;
 	unsigned int		repeat_rate_ms_;
 
+	// compiled hotkey sequences and scancode maps; owned by the plugin
+	SequenceMatcher const	*hotkeys_;
+	ScancodeMapSet const	*scancode_maps_;
+	ThreadScheduling const	*scheduling_;
+	cString			coldplug_dir_;
+
 	cInputDeviceController(cInputDeviceController const &);
 
 	bool		open_generic(int fd_udev);
-	void		cleanup_devices(void);
+
+	class cInputEventLoop	*select_loop(void);
+	int		get_epoll_fd(class cInputDevice const *dev) const;
 
 	bool		coldplug_devices(char const *);
+	unsigned int	queue_coldplug(char const *path);
 
 	void		dump_active_devices();
 	void		dump_gc_devices();
+	void		dump_queue();
 
 	class cInputDevice	*find_by_path(char const *path);
 
+	class SharedModmap	*get_modmap(char const *fname);
+	class SharedModmap	*find_assigned_modmap(char const *dev_path);
+
+	static bool	is_device_command(char const *cmd);
+	void		handle_command(char *line);
+	void		handle_message(char *buf, size_t len);
+
+	friend class cInputEventLoop;
+
 protected:
 	virtual void	Action(void);
 
@@ -70,6 +149,7 @@ public:
 	explicit cInputDeviceController(cPlugin &p, ModifierMap &modmap);
 	virtual ~cInputDeviceController();
 
+	bool		set_num_loops(unsigned int cnt);
 	bool		initialize(char const *coldplug_dir);
 	bool		start(void);
 	void		stop(void);
@@ -78,16 +158,86 @@ public:
 
 	bool		open_udev_socket(char const *sock_path);
 	bool		open_udev_socket(unsigned int systemd_idx);
+	bool		open_netlink(char const *coldplug_dir);
+	// maximum size of a datagram on the control socket
+	void		set_recv_bufsize(size_t sz);
+
+	// per-device statistics; one line per device
+	cString		get_stats(void);
+	void		log_stats(void);
+
+	// executes a single command of the control socket protocol; can be
+	// called from any thread
+	void		execute_command(char const *cmd);
 
 	bool		add_device(char const *dev);
+	// adds the devices of the coldplug directory again
+	void		reattach_devices(void);
 	void		remove_device(char const *dev);
 	void		remove_device(class cInputDevice *dev);
 	void		change_quirk(char const *dev, char const *quirk);
+	void		change_key_policy(char const *dev, char const *spec);
+	void		change_rel_threshold(char const *dev, char const *spec);
 
 	bool		set_repeat_rate(unsigned int delay_ms,
 					unsigned int rate_ms);
 
-	ModifierMap const	&get_modmap() const { return mod_map_; }
+	unsigned int	get_repeat_delay(void) const {
+		return __atomic_load_n(&repeat_delay_ms_, __ATOMIC_RELAXED);
+	}
+
+	unsigned int	get_repeat_rate(void) const {
+		return __atomic_load_n(&repeat_rate_ms_, __ATOMIC_RELAXED);
+	}
+
+	class cInputKeyRepeater	&get_repeater(void) { return *repeater_; }
+
+	void		set_hotkeys(SequenceMatcher const &hotkeys) {
+		hotkeys_ = &hotkeys;
+	}
+
+	SequenceMatcher const	*get_hotkeys(void) const { return hotkeys_; }
+
+	void		set_scancode_maps(ScancodeMapSet const &maps) {
+		scancode_maps_ = &maps;
+	}
+
+	ScancodeMapSet const	*get_scancode_maps(void) const {
+		return scancode_maps_;
+	}
+
+	void		set_scheduling(ThreadScheduling const &sched) {
+		scheduling_ = &sched;
+	}
+
+	// called by the event and delivery threads when they start
+	void		apply_scheduling(char const *thread) const;
+
+	TranslationTable const	*get_translation() const;
+
+	EpochDomain		&get_epoch() { return epoch_; }
+	void			wakeup_loops(void);
+
+	// retires 'obj' and wakes up the event loops; they hold a read
+	// section while waiting and would free it only with their next event
+	void			retire(EpochObject *obj);
+
+	void		set_modmap_fname(char const *fname);
+	void		set_cache_dir(char const *dir);
+	char const	*get_cache_dir(void) const { return cache_dir_; }
+
+	class DeviceProfileCache	&get_profiles(void) { return *profiles_; }
+	static cString	get_dev_path(char const *dev_name);
+	bool		run_device_command(char const *cmd, char const *dev);
+	void		queue_device_command(char const *cmd, char const *dev);
+
+	void		reload_modmap(void);
+	void		assign_modmap(char const *dev, char const *fname);
+
+	class SharedModmap	*ref_modmap(class SharedModmap *modmap);
+	void		put_modmap(class SharedModmap *modmap);
+
+	bool		queue_key(struct KeyEvent const &key);
 
 	static void	close(int &fd);
 
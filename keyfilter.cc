@@ -0,0 +1,104 @@
+/*	--*- c++ -*--
+ * Copyright (C) 2014 Enrico Scholz <ensc@ensc.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 and/or 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "keyfilter.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+KeyFilter::KeyFilter()
+{
+	memset(policies_, 0, sizeof policies_);
+	reset();
+}
+
+void KeyFilter::reset(void)
+{
+	memset(stamps_, 0, sizeof stamps_);
+	memset(stamped_, 0, sizeof stamped_);
+}
+
+bool KeyFilter::accept(struct input_event const &ev, unsigned int default_ms)
+{
+	unsigned int	code = ev.code;
+	unsigned int	interval;
+	uint32_t	now;
+
+	if (code >= KEY_CNT || ev.value == 0)
+		return true;
+
+	switch (get_policy(code)) {
+	case POLICY_PASS:
+		return true;
+
+	case POLICY_NOREPEAT:
+		if (ev.value == 2)
+			return false;
+
+		interval = default_ms;
+		break;
+
+	case POLICY_DEFAULT:
+		if (ev.value == 2)
+			return true;
+
+		interval = default_ms;
+		break;
+
+	default:
+		interval = get_policy(code);
+		break;
+	}
+
+	if (interval == 0)
+		return true;
+
+	now = ev.time.tv_sec * 1000u + ev.time.tv_usec / 1000;
+
+	if (test_bit(code, stamped_) &&
+	    (int32_t)(now - stamps_[code]) < (int32_t)interval)
+		return false;
+
+	stamps_[code] = now;
+	set_bit(code, stamped_);
+
+	return true;
+}
+
+bool KeyFilter::parse_policy(char const *str, uint16_t &policy)
+{
+	unsigned long	v;
+	char		*end;
+
+	if (strcasecmp(str, "default") == 0) {
+		policy = POLICY_DEFAULT;
+	} else if (strcasecmp(str, "norepeat") == 0) {
+		policy = POLICY_NOREPEAT;
+	} else if (strcasecmp(str, "pass") == 0) {
+		policy = POLICY_PASS;
+	} else {
+		errno = 0;
+		v = strtoul(str, &end, 10);
+		if (errno != 0 || end == str || *end != '\0' ||
+		    v == 0 || v > MAX_INTERVAL)
+			return false;
+
+		policy = v;
+	}
+
+	return true;
+}
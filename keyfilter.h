@@ -0,0 +1,89 @@
+/*	--*- c++ -*--
+ * Copyright (C) 2014 Enrico Scholz <ensc@ensc.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 and/or 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_VDR_INPUTDEV_KEYFILTER_H
+#define H_ENSC_VDR_INPUTDEV_KEYFILTER_H
+
+#include <stdint.h>
+#include <linux/input.h>
+
+#include "util.h"
+
+// Per-key repeat policies of a device together with the timestamps of the
+// last accepted events.  Every event is checked with one table lookup.
+//
+// Policies are changed by the device workers while the event loop reads
+// them; timestamps are used by the event loop only.
+class KeyFilter {
+public:
+	enum {
+		// drop presses which arrive faster than the interval given to
+		// accept(); used by the 'broken_repeat' quirk
+		POLICY_DEFAULT	= 0,
+		// like POLICY_DEFAULT but repeats are dropped
+		POLICY_NOREPEAT	= 0xffff,
+		// never drop anything
+		POLICY_PASS	= 0xfffe,
+
+		// other values are the minimum interval in milliseconds
+		// between two presses or repeats of the key
+		MAX_INTERVAL	= 0xfff0,
+	};
+
+	KeyFilter();
+
+	void		set_policy(unsigned int code, uint16_t policy) {
+		if (code < KEY_CNT)
+			__atomic_store_n(&policies_[code], policy,
+					 __ATOMIC_RELAXED);
+	}
+
+	uint16_t	get_policy(unsigned int code) const {
+		if (code >= KEY_CNT)
+			return POLICY_DEFAULT;
+
+		return __atomic_load_n(&policies_[code], __ATOMIC_RELAXED);
+	}
+
+	bool		allows_repeat(unsigned int code) const {
+		return get_policy(code) != POLICY_NOREPEAT;
+	}
+
+	// returns false when the EV_KEY event must be dropped; 'default_ms'
+	// is the interval for keys with POLICY_DEFAULT (0 disables it).
+	// Releases always pass.
+	bool		accept(struct input_event const &ev,
+			       unsigned int default_ms);
+
+	// forgets all timestamps
+	void		reset(void);
+
+	// 'default', 'norepeat', 'pass' or an interval in milliseconds
+	static bool	parse_policy(char const *str, uint16_t &policy);
+
+private:
+	uint16_t	policies_[KEY_CNT];
+
+	// milliseconds of the last accepted press or repeat; wraps around
+	// and is valid only when the bit in 'stamped_' is set
+	uint32_t	stamps_[KEY_CNT];
+	unsigned long	stamped_[BITS_TO_LONGS(KEY_CNT)];
+
+	KeyFilter(KeyFilter const &);
+	KeyFilter &operator = (KeyFilter const &);
+};
+
+#endif	/* H_ENSC_VDR_INPUTDEV_KEYFILTER_H */
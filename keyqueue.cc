@@ -0,0 +1,222 @@
+/*	--*- c++ -*--
+ * Copyright (C) 2014 Enrico Scholz <ensc@ensc.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 and/or 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "keyqueue.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "util.h"
+
+KeyQueue::Ring::Ring(unsigned int capacity) :
+	cells_(new struct cell[capacity]), capacity_(capacity), head_(0),
+	tail_(0)
+{
+	for (size_t i = 0; i < capacity_; ++i)
+		cells_[i].seq = i;
+}
+
+KeyQueue::Ring::~Ring()
+{
+	delete[] cells_;
+}
+
+bool KeyQueue::Ring::push(struct KeyEvent const &key,
+			  unsigned int &occupancy)
+{
+	unsigned long	pos = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+	struct cell	*cell;
+	long		diff;
+
+	for (;;) {
+		unsigned long	seq;
+
+		cell = &cells_[pos % capacity_];
+		seq  = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		diff = (long)(seq - pos);
+
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&head_, &pos, pos + 1,
+							true,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+		}
+	}
+
+	cell->key = key;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_SEQ_CST);
+
+	// the consumer might have passed 'pos' already
+	diff      = (long)(pos + 1 - __atomic_load_n(&tail_, __ATOMIC_RELAXED));
+	occupancy = diff > 0 ? diff : 0;
+
+	return true;
+}
+
+bool KeyQueue::Ring::pop(struct KeyEvent &key)
+{
+	unsigned long	pos = tail_;
+	struct cell	*cell = &cells_[pos % capacity_];
+	unsigned long	seq = __atomic_load_n(&cell->seq, __ATOMIC_SEQ_CST);
+
+	if ((long)(seq - (pos + 1)) < 0)
+		// empty
+		return false;
+
+	key = cell->key;
+
+	__atomic_store_n(&cell->seq, pos + capacity_, __ATOMIC_RELEASE);
+	__atomic_store_n(&tail_, pos + 1, __ATOMIC_RELAXED);
+
+	return true;
+}
+
+// must be called by the consumer
+bool KeyQueue::Ring::is_empty(void) const
+{
+	struct cell const	*cell = &cells_[tail_ % capacity_];
+
+	return (long)(__atomic_load_n(&cell->seq, __ATOMIC_SEQ_CST) -
+		      (tail_ + 1)) < 0;
+}
+
+unsigned int KeyQueue::Ring::get_occupancy(void) const
+{
+	// read 'tail_' first; it never passes 'head_'
+	unsigned long	tail = __atomic_load_n(&tail_, __ATOMIC_RELAXED);
+	unsigned long	head = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+
+	return head - tail;
+}
+
+KeyQueue::KeyQueue() :
+	normal_(CAPACITY), critical_(CRITICAL_CAPACITY), max_occupancy_(0),
+	num_dropped_(0), fd_event_(-1), is_sleeping_(false)
+{
+}
+
+KeyQueue::~KeyQueue()
+{
+	if (fd_event_ != -1)
+		close(fd_event_);
+}
+
+bool KeyQueue::open(void)
+{
+	fd_event_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	return fd_event_ >= 0;
+}
+
+bool KeyQueue::push(struct KeyEvent const &key)
+{
+	unsigned int	occupancy = 0;
+	unsigned int	max;
+	bool		is_queued;
+
+	if (key.is_critical && key.is_repeated &&
+	    critical_.get_occupancy() >= CRITICAL_CAPACITY / 2) {
+		// repeats must not use the room reserved for presses and
+		// releases; they are kept in the critical lane otherwise so
+		// that they can not arrive after the release
+		is_queued = false;
+	} else if (key.is_critical) {
+		is_queued = critical_.push(key, occupancy);
+	} else {
+		is_queued = normal_.push(key, occupancy);
+
+		max = __atomic_load_n(&max_occupancy_, __ATOMIC_RELAXED);
+		while (is_queued && occupancy > max &&
+		       !__atomic_compare_exchange_n(&max_occupancy_, &max,
+						    occupancy, true,
+						    __ATOMIC_RELAXED,
+						    __ATOMIC_RELAXED))
+			;		// noop
+	}
+
+	if (!is_queued) {
+		__atomic_fetch_add(&num_dropped_, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+
+	// the eventfd is written only when the consumer is about to sleep
+	if (__atomic_exchange_n(&is_sleeping_, false, __ATOMIC_SEQ_CST))
+		wakeup();
+
+	return true;
+}
+
+bool KeyQueue::pop(struct KeyEvent &key)
+{
+	return normal_.pop(key);
+}
+
+bool KeyQueue::pop_critical(struct KeyEvent &key)
+{
+	return critical_.pop(key);
+}
+
+void KeyQueue::wait(int timeout_ms)
+{
+	struct pollfd	pfd = { fd_event_, POLLIN, 0 };
+	uint64_t	cnt;
+	ssize_t		rc;
+
+	__atomic_store_n(&is_sleeping_, true, __ATOMIC_SEQ_CST);
+
+	// recheck after announcing the sleep; a producer which filled a
+	// cell before might not have seen the flag
+	if (normal_.is_empty() && critical_.is_empty())
+		poll(&pfd, 1, timeout_ms);
+
+	__atomic_store_n(&is_sleeping_, false, __ATOMIC_SEQ_CST);
+
+	// consume the wakeup; errors (EAGAIN) are expected
+	rc = read(fd_event_, &cnt, sizeof cnt);
+	(void)rc;
+}
+
+void KeyQueue::wakeup(void)
+{
+	uint64_t	one = 1;
+	ssize_t		rc;
+
+	// EAGAIN when counter overflows can be ignored; the consumer is
+	// woken up already then
+	rc = write(fd_event_, &one, sizeof one);
+	(void)rc;
+}
+
+unsigned int KeyQueue::get_occupancy(void) const
+{
+	return normal_.get_occupancy();
+}
+
+unsigned int KeyQueue::get_max_occupancy(void) const
+{
+	return __atomic_load_n(&max_occupancy_, __ATOMIC_RELAXED);
+}
+
+unsigned long KeyQueue::get_num_dropped(void) const
+{
+	return __atomic_load_n(&num_dropped_, __ATOMIC_RELAXED);
+}
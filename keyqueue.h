@@ -0,0 +1,119 @@
+/*	--*- c++ -*--
+ * Copyright (C) 2014 Enrico Scholz <ensc@ensc.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 and/or 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_VDR_INPUTDEV_KEYQUEUE_H
+#define H_ENSC_VDR_INPUTDEV_KEYQUEUE_H
+
+#include <stdint.h>
+#include <time.h>
+#include <linux/input.h>
+
+class DeviceStats;
+
+struct KeyEvent {
+	struct input_event	ev;		// the originating event
+	uint64_t		code;
+	bool			is_raw;
+	bool			is_repeated;
+	bool			is_released;
+	// kPower, kStop or kBack; queued in a separate lane which is
+	// delivered before all other keys
+	bool			is_critical;
+	clockid_t		clock_id;	// clock of 'ev.time'
+	class DeviceStats	*stats;		// referenced
+};
+
+// Bounded, lock-free queue with multiple producers and a single consumer.
+// Based on the algorithm by Dmitry Vyukov; every cell carries a sequence
+// number which tells whether it is free for the producer or filled for the
+// consumer.
+//
+// Critical keys have their own lane so that a flood of repeats can not
+// reject them; the consumer drains it first.
+class KeyQueue {
+public:
+	enum {
+		CAPACITY		= 256,
+		CRITICAL_CAPACITY	= 64,
+	};
+
+	KeyQueue();
+	~KeyQueue();
+
+	bool		open(void);
+
+	// returns false when the lane of the key is full; the key is dropped
+	// then
+	bool		push(struct KeyEvent const &key);
+	// pop() returns only normal keys; critical ones are returned by
+	// pop_critical()
+	bool		pop(struct KeyEvent &key);
+	bool		pop_critical(struct KeyEvent &key);
+
+	// blocks the consumer until keys are available, 'timeout_ms' passed
+	// or wakeup() was called
+	void		wait(int timeout_ms);
+	void		wakeup(void);
+
+	// statistics of the normal lane
+	unsigned int	get_occupancy(void) const;
+	unsigned int	get_max_occupancy(void) const;
+	// number of dropped keys of both lanes
+	unsigned long	get_num_dropped(void) const;
+
+private:
+	struct cell {
+		unsigned long		seq;
+		struct KeyEvent		key;
+	};
+
+	class Ring {
+	public:
+		explicit Ring(unsigned int capacity);
+		~Ring();
+
+		// returns false when the ring is full; 'occupancy' is set
+		// to the number of keys after adding this one
+		bool		push(struct KeyEvent const &key,
+				     unsigned int &occupancy);
+		bool		pop(struct KeyEvent &key);
+		bool		is_empty(void) const;
+		unsigned int	get_occupancy(void) const;
+
+	private:
+		struct cell	*cells_;
+		unsigned int	capacity_;
+		unsigned long	head_;	// next position for producers
+		unsigned long	tail_;	// next position for the consumer
+
+		Ring(Ring const &);
+		Ring &operator = (Ring const &);
+	};
+
+	Ring		normal_;
+	Ring		critical_;
+
+	unsigned int	max_occupancy_;
+	unsigned long	num_dropped_;
+
+	int		fd_event_;
+	bool		is_sleeping_;
+
+	KeyQueue(KeyQueue const &);
+	KeyQueue &operator = (KeyQueue const &);
+};
+
+#endif	/* H_ENSC_VDR_INPUTDEV_KEYQUEUE_H */
@@ -17,8 +17,12 @@
 #include "modmap.h"
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <linux/input.h>
 #include <vdr/tools.h>
 
@@ -27,12 +31,31 @@
 
 #define ARRAY_SIZE(_a)	(sizeof(_a) / sizeof(_a)[0])
 
-ModifierMap::ModifierMap()
+// Layout of the compiled modmap cache; the keytables follow the header
+// directly and are used in place.  Entries are in host byte order; the
+// file is bound to the source by inode, size and mtime.
+struct modmap_cache_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	key_cnt;
+	uint32_t	num_tables;
+	uint32_t	char_size;
+	uint32_t	fname_hash;
+	uint32_t	_pad;
+	uint64_t	src_ino;
+	uint64_t	src_size;
+	int64_t		src_mtime_sec;
+	int64_t		src_mtime_nsec;
+};
+
+static char const	CACHE_MAGIC[8] = { 'I', 'D', 'E', 'V', 'M', 'M', 'A', 'P' };
+static unsigned int const	CACHE_VERSION = 1;
+
+ModifierMap::ModifierMap() :
+	cache_map_(NULL), cache_map_len_(0)
 {
-	for (size_t i = 0; i < ARRAY_SIZE(keytables_); ++i) {
-		keytables_[i] = new wchar_t[KEY_MAX];
-		memset(keytables_[i], 0, sizeof keytables_[i][0] * KEY_MAX);
-	}
+	keytables_ = new wchar_t[_ktMAX][KEY_CNT];
+	memset(keytables_, 0, sizeof keytables_[0] * _ktMAX);
 
 	set_default_tables();
 }
@@ -107,8 +130,10 @@ void ModifierMap::set_default_tables()
 
 ModifierMap::~ModifierMap()
 {
-	for (size_t i = ARRAY_SIZE(keytables_); i > 0; --i)
-		delete [] keytables_[i-1];
+	if (cache_map_)
+		munmap(cache_map_, cache_map_len_);
+	else
+		delete [] keytables_;
 }
 
 static wchar_t utf8_to_wchar(char const *str)
@@ -149,7 +174,161 @@ static wchar_t utf8_to_wchar(char const *str)
 	return r;
 }
 
-bool ModifierMap::read_modmap(char const *fname)
+static void fill_cache_header(struct modmap_cache_header &hdr,
+			      char const *fname, struct stat const &st)
+{
+	memset(&hdr, 0, sizeof hdr);
+	memcpy(hdr.magic, CACHE_MAGIC, sizeof hdr.magic);
+
+	hdr.version        = CACHE_VERSION;
+	hdr.key_cnt        = KEY_CNT;
+	hdr.num_tables     = ModifierMap::_ktMAX;
+	hdr.char_size      = sizeof(wchar_t);
+	hdr.fname_hash     = fnv1a_hash(fname);
+	hdr.src_ino        = st.st_ino;
+	hdr.src_size       = st.st_size;
+	hdr.src_mtime_sec  = st.st_mtim.tv_sec;
+	hdr.src_mtime_nsec = st.st_mtim.tv_nsec;
+}
+
+static cString get_cache_fname(char const *fname, char const *cache_dir)
+{
+	return cString::sprintf("%s/modmap-%08x.bin", cache_dir,
+				fnv1a_hash(fname));
+}
+
+bool ModifierMap::load_cache(char const *cache_fname, char const *fname,
+			     struct stat const &st)
+{
+	struct modmap_cache_header		hdr;
+	struct modmap_cache_header const	*cache_hdr;
+	size_t		len = sizeof hdr + sizeof keytables_[0] * _ktMAX;
+	struct stat	cache_st;
+	void		*map = MAP_FAILED;
+	int		fd;
+
+	fd = open(cache_fname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		// no cache yet; not an error
+		goto err;
+
+	if (fstat(fd, &cache_st) < 0 || (size_t)cache_st.st_size != len)
+		goto err;
+
+	// the mapping is private and writable so that read_modmap() can be
+	// called again on this object; the cache itself is only replaced by
+	// rename() and never modified in place
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		goto err;
+
+	cache_hdr = static_cast<struct modmap_cache_header const *>(map);
+	fill_cache_header(hdr, fname, st);
+
+	if (memcmp(&hdr, cache_hdr, sizeof hdr) != 0)
+		goto err;
+
+	close(fd);
+
+	if (cache_map_)
+		munmap(cache_map_, cache_map_len_);
+	else
+		delete [] keytables_;
+
+	cache_map_     = map;
+	cache_map_len_ = len;
+	keytables_     = reinterpret_cast<wchar_t (*)[KEY_CNT]>(
+		static_cast<char *>(map) + sizeof hdr);
+
+	return true;
+
+err:
+	if (map != MAP_FAILED)
+		munmap(map, len);
+
+	if (fd >= 0)
+		close(fd);
+
+	return false;
+}
+
+bool ModifierMap::write_cache(char const *cache_fname, char const *fname,
+			      struct stat const &st) const
+{
+	struct modmap_cache_header	hdr;
+	cString		tmp_fname = cString::sprintf("%s.XXXXXX", cache_fname);
+	char		*tmp_buf = strdup(tmp_fname);
+	int		fd = -1;
+
+	if (!tmp_buf)
+		goto err;
+
+	fd = mkstemp(tmp_buf);
+	if (fd < 0)
+		goto err;
+
+	fill_cache_header(hdr, fname, st);
+
+	if (write(fd, &hdr, sizeof hdr) != (ssize_t)(sizeof hdr) ||
+	    write(fd, keytables_, sizeof keytables_[0] * _ktMAX) !=
+	    (ssize_t)(sizeof keytables_[0] * _ktMAX))
+		goto err;
+
+	if (close(fd) < 0) {
+		fd = -1;
+		goto err;
+	}
+
+	fd = -1;
+
+	if (rename(tmp_buf, cache_fname) < 0)
+		goto err;
+
+	free(tmp_buf);
+	return true;
+
+err:
+	esyslog("failed to write modmap cache '%s': %s", cache_fname,
+		strerror(errno));
+
+	if (fd >= 0)
+		close(fd);
+
+	if (tmp_buf) {
+		unlink(tmp_buf);
+		free(tmp_buf);
+	}
+
+	return false;
+}
+
+bool ModifierMap::read_modmap(char const *fname, char const *cache_dir)
+{
+	struct stat	st;
+	cString		cache_fname;
+
+	if (!cache_dir)
+		return parse_modmap(fname);
+
+	if (stat(fname, &st) < 0) {
+		esyslog("failed to stat keymap file '%s': %s",
+			fname, strerror(errno));
+		return false;
+	}
+
+	cache_fname = get_cache_fname(fname, cache_dir);
+
+	if (load_cache(cache_fname, fname, st))
+		return true;
+
+	if (!parse_modmap(fname))
+		return false;
+
+	write_cache(cache_fname, fname, st);
+	return true;
+}
+
+bool ModifierMap::parse_modmap(char const *fname)
 {
 	FILE		*f = fopen(fname, "r");
 	cReadLine	r;
@@ -181,14 +360,16 @@ bool ModifierMap::read_modmap(char const *fname)
 			continue;
 		}
 
-		for (size_t v_idx = 0; v_idx < ARRAY_SIZE(keytables_); ++v_idx) {
+		for (size_t v_idx = 0; v_idx < NUM_COLUMNS; ++v_idx) {
 			char const	*s;
 
 			s = strtok_r(NULL, DELIMS, &buf_next);
 			if (!s)
 				break;
 
-			if (strncmp(s, "\\x", 2) == 0) {
+			if (v_idx >= _ktMAX) {
+				// noop; column is not used
+			} else if (strncmp(s, "\\x", 2) == 0) {
 				keytables_[v_idx][keydef->num] = strtoul(s+2, NULL, 16);
 				// \todo: error checks
 			} else if (strncmp(s, "\\", 2) == 0) {
@@ -214,13 +395,9 @@ bool ModifierMap::read_modmap(char const *fname)
 	return true;
 }
 
-bool ModifierMap::translate(wchar_t &chr, unsigned int code,
-			    unsigned long mask) const
+enum ModifierMap::keytable ModifierMap::get_keytable(unsigned long mask)
 {
-	ssize_t		idx = -1;
-
-	if (code >= KEY_MAX)
-		return false;
+	enum keytable	idx;
 
 	if (test_bit(modCAPSLOCK, &mask))
 		change_bit(modSHIFT, &mask);
@@ -239,8 +416,23 @@ bool ModifierMap::translate(wchar_t &chr, unsigned int code,
 	else
 		idx = ktNORMAL;
 
-	if (idx != -1)
-		chr = keytables_[idx][code];
+	return idx;
+}
+
+int ModifierMap::find_keycode(char const *name)
+{
+	struct keymap_def const	*keydef;
+	unsigned long		v;
+	char			*end;
+
+	keydef = Perfect_Hash::in_word_set(name, strlen(name));
+	if (keydef)
+		return keydef->num;
+
+	errno = 0;
+	v = strtoul(name, &end, 0);
+	if (errno != 0 || end == name || *end != '\0' || v >= KEY_CNT)
+		return -1;
 
-	return idx != -1 && chr != L'\0';
+	return v;
 }
@@ -17,6 +17,10 @@
 #ifndef HH_ENSC_VDR_INPUTDEV_MODMAP_HH
 #define HH_ENSC_VDR_INPUTDEV_MODMAP_HH
 
+#include <stddef.h>
+#include <sys/stat.h>
+#include <linux/input.h>
+
 class ModifierMap {
 public:
 	enum modifier {
@@ -31,33 +35,57 @@ public:
 		_modMAX,
 	};
 
-	ModifierMap();
-	~ModifierMap();
-
-	bool	read_modmap(char const *fname);
-	bool	translate(wchar_t &chr, unsigned int code,
-			  unsigned long mask) const;
-
-private:
-	enum {
+	enum keytable {
 		ktNORMAL,
 		ktSHIFT,
 		ktCONTROL,
 		ktMODE,
 		ktMODE_SHIFT,
-		ktUNUSED0,
-		ktUNUSED1,
-		ktUNUSED2,
 
 		_ktMAX
 	};
 
-	typedef wchar_t		*keytable_t;
+	ModifierMap();
+	~ModifierMap();
+
+	// reads the modmap; when 'cache_dir' is given, a compiled version of
+	// the file is tried first and regenerated when it is stale
+	bool	read_modmap(char const *fname, char const *cache_dir = NULL);
 
-	// same semantics like 'keycode' in xmodmap(1)
-	keytable_t		keytables_[_ktMAX];
+	static enum keytable	get_keytable(unsigned long mask);
+
+	// translates a key name like used in the modmap file ('power',
+	// 'kpenter') or a numeric code into the EV_KEY code; returns -1 when
+	// it is unknown
+	static int		find_keycode(char const *name);
+
+	wchar_t			get_char(enum keytable kt,
+					 unsigned int code) const {
+		return code < KEY_CNT ? keytables_[kt][code] : L'\0';
+	}
+
+private:
+	// number of columns in the modmap file; same semantics like
+	// 'keycode' in xmodmap(1) but only the first _ktMAX ones are used
+	static size_t const	NUM_COLUMNS = 8;
+
+	wchar_t			(*keytables_)[KEY_CNT];
+
+	// mapping of the compiled cache file; 'keytables_' points into it
+	// when set
+	void			*cache_map_;
+	size_t			cache_map_len_;
+
+	ModifierMap(ModifierMap const &);
+	ModifierMap &operator = (ModifierMap const &);
 
 	void	set_default_tables(void);
+	bool	parse_modmap(char const *fname);
+
+	bool	load_cache(char const *cache_fname, char const *fname,
+			   struct stat const &st);
+	bool	write_cache(char const *cache_fname, char const *fname,
+			    struct stat const &st) const;
 };
 
 #endif	/* HH_ENSC_VDR_INPUTDEV_MODMAP_HH */
@@ -14,13 +14,19 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
 #include <getopt.h>
+#include <limits.h>
 #include <unistd.h>
 
 #include <vdr/plugin.h>
 
 #include "inputdev.h"
 #include "modmap.h"
+#include "profile.h"
+#include "rtsched.h"
+#include "scancodes.h"
+#include "sequence.h"
 
 static char const *DEFAULT_SOCKET_PATH = SOCKET_PATH;
 static const char *VERSION        = PACKAGE_VERSION;
@@ -30,6 +36,9 @@ class cInputDevicePlugin : public cPlugin {
 private:
 	class cInputDeviceController	*controller_;
 	ModifierMap			mod_map_;
+	SequenceMatcher			hotkeys_;
+	ScancodeMapSet			scancode_maps_;
+	ThreadScheduling		sched_;
 
 	enum {
 		enSOCKET,
@@ -43,6 +52,9 @@ private:
 
 	cString				coldplug_dir;
 	cString				mod_map_fname_;
+	unsigned int			num_loops_;
+	bool				use_netlink_;
+	unsigned int			recv_bufsz_;
 
 private:
 	cInputDevicePlugin(cInputDevicePlugin const &);
@@ -59,10 +71,15 @@ public:
 	virtual bool	Initialize(void);
 	virtual bool	Start(void);
 	virtual void	Stop(void);
+
+	virtual const char	**SVDRPHelpPages(void);
+	virtual cString		SVDRPCommand(const char *cmd, const char *option,
+					     int &reply_code);
 };
 
 cInputDevicePlugin::cInputDevicePlugin() :
-	controller_(NULL), coldplug_dir("/dev/vdr/input")
+	controller_(NULL), coldplug_dir("/dev/vdr/input"), num_loops_(0),
+	use_netlink_(false), recv_bufsz_(0)
 {
 }
 
@@ -71,12 +88,40 @@ cInputDevicePlugin::~cInputDevicePlugin(void)
 	delete controller_;
 }
 
+static bool parse_uint(char const *plugin, char const *opt, char const *str,
+		       unsigned int &res)
+{
+	char		*end;
+	unsigned long	v;
+
+	errno = 0;
+	v = strtoul(str, &end, 10);
+
+	// strtoul() accepts a sign; reject it instead of wrapping around
+	if (errno != 0 || end == str || *end != '\0' || v > UINT_MAX ||
+	    strchr(str, '-') != NULL) {
+		esyslog("%s: invalid value '%s' for --%s\n", plugin, str, opt);
+		return false;
+	}
+
+	res = v;
+	return true;
+}
+
 bool cInputDevicePlugin::ProcessArgs(int argc, char *argv[])
 {
 	static struct option const	CMDLINE_OPTIONS[] = {
 		{ "systemd", required_argument, NULL, 'S' },
 		{ "socket",  required_argument, NULL, 's' },
 		{ "modmap",  required_argument, NULL, 'M' },
+		{ "threads", required_argument, NULL, 't' },
+		{ "netlink", no_argument,       NULL, 'n' },
+		{ "recv-buffer", required_argument, NULL, 'b' },
+		{ "hotkey",  required_argument, NULL, 'k' },
+		{ "keymap",  required_argument, NULL, 'K' },
+		{ "rt-policy",   required_argument, NULL, 'P' },
+		{ "rt-priority", required_argument, NULL, 'p' },
+		{ "cpus",    required_argument, NULL, 'c' },
 		{ }
 	};
 
@@ -87,7 +132,7 @@ bool cInputDevicePlugin::ProcessArgs(int argc, char *argv[])
 	for (;;) {
 		int		c;
 
-		c = getopt_long(argc, argv, "S:s:M:", CMDLINE_OPTIONS, NULL);
+		c = getopt_long(argc, argv, "S:s:M:t:nb:k:K:P:p:c:", CMDLINE_OPTIONS, NULL);
 		if (c == -1)
 			break;
 
@@ -103,6 +148,36 @@ bool cInputDevicePlugin::ProcessArgs(int argc, char *argv[])
 #endif
 		case 's':  socket_path = optarg; break;
 		case 'M':  mod_map_fname_ = optarg; break;
+		case 't':
+			if (!parse_uint(Name(), "threads", optarg, num_loops_))
+				return false;
+			break;
+		case 'n':  use_netlink_ = true; break;
+		case 'b':
+			if (!parse_uint(Name(), "recv-buffer", optarg,
+					recv_bufsz_))
+				return false;
+			break;
+		case 'k':
+			if (!hotkeys_.add(optarg))
+				return false;
+			break;
+		case 'K':
+			if (!scancode_maps_.add(optarg))
+				return false;
+			break;
+		case 'P':
+			if (!sched_.set_policy(optarg))
+				return false;
+			break;
+		case 'p':
+			if (!sched_.set_priority(optarg))
+				return false;
+			break;
+		case 'c':
+			if (!sched_.set_cpus(optarg))
+				return false;
+			break;
 		default:
 			esyslog("%s: invalid option\n", Name());
 			return false;
@@ -133,12 +208,35 @@ bool cInputDevicePlugin::ProcessArgs(int argc, char *argv[])
 bool cInputDevicePlugin::Initialize(void)
 {
 	bool		is_ok;
+	// CacheDirectory() returns a static buffer; keep a copy
+	cString		cache_dir = CacheDirectory(Name());
 
 	if (mod_map_fname_ != "")
-		mod_map_.read_modmap(mod_map_fname_);
+		mod_map_.read_modmap(mod_map_fname_, cache_dir);
 	// \todo: handle errors?
 
+	if (hotkeys_.empty())
+		// the traditional magic keysequence
+		hotkeys_.add("leftshift,leftshift,esc,leftshift=detach");
+
+	if (!hotkeys_.compile())
+		return false;
+
 	controller_ = new cInputDeviceController(*this, mod_map_);
+	controller_->set_hotkeys(hotkeys_);
+	controller_->set_scancode_maps(scancode_maps_);
+	controller_->set_scheduling(sched_);
+	controller_->set_modmap_fname(mod_map_fname_);
+	controller_->set_cache_dir(cache_dir);
+	controller_->get_profiles().set_fname(
+		cString::sprintf("%s/profiles.conf", ConfigDirectory(Name())));
+
+	if (recv_bufsz_ > 0)
+		controller_->set_recv_bufsize(recv_bufsz_);
+
+	is_ok = controller_->set_num_loops(num_loops_);
+	if (!is_ok)
+		goto out;
 
 	switch (socket_type_) {
 #ifdef VDR_USE_SYSTEMD
@@ -158,9 +256,13 @@ bool cInputDevicePlugin::Initialize(void)
 		break;
 	}
 
+	if (is_ok && use_netlink_)
+		is_ok = controller_->open_netlink(coldplug_dir);
+
 	if (is_ok)
 		is_ok = controller_->initialize(coldplug_dir);
 
+out:
 	if (!is_ok) {
 		delete controller_;
 		controller_ = NULL;
@@ -181,4 +283,46 @@ void cInputDevicePlugin::Stop(void)
 	controller_ = NULL;
 }
 
+const char **cInputDevicePlugin::SVDRPHelpPages(void)
+{
+	static const char	*HELP_PAGES[] = {
+		"STAT\n"
+		"    Print the key queue state and per-device statistics: events\n"
+		"    and bytes read, keys delivered, keys suppressed by the\n"
+		"    broken_repeat quirk or key policies, failed Put() calls,\n"
+		"    SYN_DROPPED events, repeats dropped while vdr was busy,\n"
+		"    age of the last event and the 99th latency percentile.",
+		"CTRL <command> <arg>\n"
+		"    Execute a command like it was sent to the hotplug socket\n"
+		"    (e.g. 'CTRL quirk:+broken_repeat event3').",
+		NULL
+	};
+
+	return HELP_PAGES;
+}
+
+cString cInputDevicePlugin::SVDRPCommand(const char *cmd, const char *option,
+					 int &reply_code)
+{
+	if (!controller_) {
+		reply_code = 554;
+		return "plugin not initialized";
+	}
+
+	if (strcasecmp(cmd, "STAT") == 0)
+		return controller_->get_stats();
+
+	if (strcasecmp(cmd, "CTRL") == 0) {
+		if (!option || !option[0]) {
+			reply_code = 501;
+			return "missing command";
+		}
+
+		controller_->execute_command(option);
+		return "command accepted";
+	}
+
+	return NULL;
+}
+
 VDRPLUGINCREATOR(cInputDevicePlugin); // Don't touch this!
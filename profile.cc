@@ -0,0 +1,320 @@
+/*	--*- c++ -*--
+ * Copyright (C) 2014 Enrico Scholz <ensc@ensc.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 and/or 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "profile.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// File format: one profile per line with tab separated fields
+//
+//   <key> <bus:vendor:product:version> <quirks> <delay>,<period>
+//   <ev bits> <key bits> <name>
+//
+// Bitmaps are written as comma separated hex words (unsigned long).  The
+// name is the last field and can contain spaces.
+
+class DeviceProfileCache::cProfileEntry : public cListObject {
+public:
+	DeviceProfile	profile;
+
+	explicit cProfileEntry(DeviceProfile const &p) : profile(p) {}
+};
+
+DeviceProfile::DeviceProfile()
+{
+	memset(&id, 0, sizeof id);
+	memset(ev_bits, 0, sizeof ev_bits);
+	memset(key_bits, 0, sizeof key_bits);
+	orig_rate[0] = 0;
+	orig_rate[1] = 0;
+}
+
+cString DeviceProfile::make_key(struct input_id const &id,
+				char const *uniq, char const *phys)
+{
+	char const	*ident;
+	cString		res;
+	char		*tmp;
+
+	if (uniq && uniq[0])
+		ident = uniq;
+	else if (phys && phys[0])
+		ident = phys;
+	else
+		ident = "-";
+
+	res = cString::sprintf("%04x:%04x:%04x:%04x/%s", id.bustype, id.vendor,
+			       id.product, id.version, ident);
+
+	// the key is a single field in the profile file
+	tmp = const_cast<char *>(*res);
+	for (; *tmp; ++tmp) {
+		if (!isgraph((unsigned char)(*tmp)))
+			*tmp = '_';
+	}
+
+	return res;
+}
+
+bool DeviceProfile::is_unique_key(char const *key)
+{
+	char const	*ident = strchr(key, '/');
+
+	return ident != NULL && strcmp(ident, "/-") != 0;
+}
+
+static void write_bits(FILE *f, unsigned long const bits[], size_t cnt)
+{
+	for (size_t i = 0; i < cnt; ++i)
+		fprintf(f, "%s%lx", i > 0 ? "," : "", bits[i]);
+}
+
+static bool parse_bits(char const *str, unsigned long bits[], size_t cnt)
+{
+	char	*end;
+
+	for (size_t i = 0; i < cnt; ++i) {
+		errno = 0;
+		bits[i] = strtoul(str, &end, 16);
+		if (errno != 0 || end == str)
+			return false;
+
+		if (*end == '\0')
+			// older file with less words; treat as zero
+			return true;
+
+		if (*end != ',')
+			return false;
+
+		str = end + 1;
+	}
+
+	return true;
+}
+
+DeviceProfileCache::DeviceProfileCache() :
+	entries_(new cList<cProfileEntry>())
+{
+}
+
+DeviceProfileCache::~DeviceProfileCache()
+{
+	delete entries_;
+}
+
+void DeviceProfileCache::set_fname(char const *fname)
+{
+	cMutexLock	lock(&lock_);
+
+	fname_ = fname;
+}
+
+DeviceProfileCache::cProfileEntry *DeviceProfileCache::find(char const *key) const
+{
+	for (cProfileEntry *i = entries_->First(); i; i = entries_->Next(i)) {
+		if (strcmp(i->profile.key, key) == 0)
+			return i;
+	}
+
+	return NULL;
+}
+
+bool DeviceProfileCache::load(void)
+{
+	cMutexLock	lock(&lock_);
+	FILE		*f;
+	cReadLine	r;
+
+	if (*fname_ == NULL)
+		return true;
+
+	f = fopen(fname_, "r");
+	if (!f && errno == ENOENT)
+		return true;
+
+	if (!f) {
+		esyslog("failed to open profile file '%s': %s",
+			*fname_, strerror(errno));
+		return false;
+	}
+
+	for (size_t line_num = 1;; ++line_num) {
+		char		*buf = r.Read(f);
+		char		*fields[7];
+		char		*buf_next;
+		size_t		cnt;
+		DeviceProfile	profile;
+		unsigned int	id[4];
+
+		if (!buf)
+			break;
+
+		if (buf[0] == '#' || buf[0] == '\0')
+			continue;
+
+		for (cnt = 0; cnt < ARRAY_SIZE(fields) - 1; ++cnt) {
+			fields[cnt] = strtok_r(cnt == 0 ? buf : NULL, "\t",
+					       &buf_next);
+			if (!fields[cnt])
+				break;
+		}
+
+		if (cnt == ARRAY_SIZE(fields) - 1)
+			// name is the remaining part of the line
+			fields[cnt++] = buf_next;
+
+		if (cnt != ARRAY_SIZE(fields) ||
+		    sscanf(fields[1], "%x:%x:%x:%x",
+			   &id[0], &id[1], &id[2], &id[3]) != 4 ||
+		    sscanf(fields[3], "%u,%u", &profile.orig_rate[0],
+			   &profile.orig_rate[1]) != 2 ||
+		    !parse_bits(fields[4], profile.ev_bits,
+				ARRAY_SIZE(profile.ev_bits)) ||
+		    !parse_bits(fields[5], profile.key_bits,
+				ARRAY_SIZE(profile.key_bits))) {
+			esyslog("%s:%zu invalid profile", *fname_, line_num);
+			continue;
+		}
+
+		try {
+			profile.quirks.parse(fields[2]);
+		} catch (Quirks::UnknownQuirkError const &e) {
+			esyslog("%s:%zu %s", *fname_, line_num, e.what());
+			continue;
+		}
+
+		if (!DeviceProfile::is_unique_key(fields[0]))
+			// written by an older version
+			continue;
+
+		profile.key        = fields[0];
+		profile.name       = fields[6];
+		profile.id.bustype = id[0];
+		profile.id.vendor  = id[1];
+		profile.id.product = id[2];
+		profile.id.version = id[3];
+
+		cProfileEntry	*entry = find(profile.key);
+
+		if (entry)
+			entry->profile = profile;
+		else
+			entries_->Add(new cProfileEntry(profile));
+	}
+
+	fclose(f);
+
+	return true;
+}
+
+bool DeviceProfileCache::save(void) const
+{
+	cString		tmp_fname;
+	FILE		*f;
+	int		fd;
+	char		*tmp_buf;
+	bool		res = false;
+
+	if (*fname_ == NULL)
+		return true;
+
+	tmp_fname = cString::sprintf("%s.XXXXXX", *fname_);
+	tmp_buf = const_cast<char *>(*tmp_fname);
+
+	fd = mkstemp(tmp_buf);
+	if (fd < 0)
+		goto err;
+
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		unlink(tmp_buf);
+		goto err;
+	}
+
+	fprintf(f, "# generated by the inputdev plugin; do not edit while vdr is running\n");
+
+	for (cProfileEntry *i = entries_->First(); i; i = entries_->Next(i)) {
+		DeviceProfile const	&p = i->profile;
+
+		fprintf(f, "%s\t%04x:%04x:%04x:%04x\t%s\t%u,%u\t", *p.key,
+			p.id.bustype, p.id.vendor, p.id.product, p.id.version,
+			p.quirks.to_string().c_str(),
+			p.orig_rate[0], p.orig_rate[1]);
+		write_bits(f, p.ev_bits, ARRAY_SIZE(p.ev_bits));
+		fputc('\t', f);
+		write_bits(f, p.key_bits, ARRAY_SIZE(p.key_bits));
+		fprintf(f, "\t%s\n", *p.name);
+	}
+
+	if (ferror(f)) {
+		fclose(f);
+		unlink(tmp_buf);
+		goto err;
+	}
+
+	if (fclose(f) != 0 || rename(tmp_buf, fname_) < 0) {
+		unlink(tmp_buf);
+		goto err;
+	}
+
+	res = true;
+
+err:
+	if (!res)
+		esyslog("failed to write profile file '%s': %s",
+			*fname_, strerror(errno));
+
+	return res;
+}
+
+bool DeviceProfileCache::lookup(char const *key, DeviceProfile &profile) const
+{
+	cMutexLock	lock(&lock_);
+	cProfileEntry	*entry;
+
+	if (!DeviceProfile::is_unique_key(key))
+		return false;
+
+	entry = find(key);
+	if (!entry)
+		return false;
+
+	profile = entry->profile;
+	return true;
+}
+
+void DeviceProfileCache::store(DeviceProfile const &profile)
+{
+	cMutexLock	lock(&lock_);
+	cProfileEntry	*entry;
+
+	if (!DeviceProfile::is_unique_key(profile.key))
+		return;
+
+	entry = find(profile.key);
+	if (entry)
+		entry->profile = profile;
+	else
+		entries_->Add(new cProfileEntry(profile));
+
+	save();
+}
@@ -0,0 +1,89 @@
+/*	--*- c++ -*--
+ * Copyright (C) 2014 Enrico Scholz <ensc@ensc.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 and/or 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_VDR_INPUTDEV_PROFILE_H
+#define H_ENSC_VDR_INPUTDEV_PROFILE_H
+
+#include <linux/input.h>
+#include <vdr/thread.h>
+#include <vdr/tools.h>
+
+#include "quirks.h"
+#include "util.h"
+
+// Probed and configured properties of a device which are kept over
+// reconnects
+struct DeviceProfile {
+	// stable identity; see make_key()
+	cString			key;
+
+	cString			name;
+	struct input_id		id;
+	unsigned long		ev_bits[BITS_TO_LONGS(EV_CNT)];
+	unsigned long		key_bits[BITS_TO_LONGS(KEY_CNT)];
+
+	Quirks			quirks;
+
+	// repeat delay and period before the plugin changed them; zero when
+	// the device does not support it
+	unsigned int		orig_rate[2];
+
+	DeviceProfile();
+
+	// builds the key from the EVIOCGID, EVIOCGUNIQ and EVIOCGPHYS
+	// information.  The unique id is preferred; the physical location is
+	// used for devices without one.
+	static cString	make_key(struct input_id const &id,
+				 char const *uniq, char const *phys);
+
+	// false for keys of devices with neither unique id nor physical
+	// location; identical devices of this kind can not be distinguished
+	// and their profiles are not cached
+	static bool	is_unique_key(char const *key);
+};
+
+// Set of known device profiles which is persisted in a text file
+class DeviceProfileCache {
+public:
+	DeviceProfileCache();
+	~DeviceProfileCache();
+
+	void		set_fname(char const *fname);
+
+	bool		load(void);
+
+	// copies the profile with the given key into 'profile'; returns
+	// false when there is none
+	bool		lookup(char const *key, DeviceProfile &profile) const;
+
+	// adds or replaces a profile and writes the file
+	void		store(DeviceProfile const &profile);
+
+private:
+	class cProfileEntry;
+
+	mutable cMutex		lock_;
+	cList<cProfileEntry>	*entries_;
+	cString			fname_;
+
+	cProfileEntry		*find(char const *key) const;
+	bool			save(void) const;
+
+	DeviceProfileCache(DeviceProfileCache const &);
+	DeviceProfileCache &operator = (DeviceProfileCache const &);
+};
+
+#endif	/* H_ENSC_VDR_INPUTDEV_PROFILE_H */
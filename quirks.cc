@@ -19,7 +19,7 @@
 
 using namespace std;
 
-Quirks::Quirks() : broken_repeat(false)
+Quirks::Quirks() : broken_repeat(false), soft_repeat(false)
 {
 }
 
@@ -27,12 +27,52 @@ bool &Quirks::find_quirk(char const *quirk) throw(UnknownQuirkError)
 {
 	if (strcasecmp(quirk, "broken_repeat") == 0)
 		return broken_repeat;
+	else if (strcasecmp(quirk, "soft_repeat") == 0)
+		return soft_repeat;
 	else
 		throw UnknownQuirkError(quirk);
 }
 
 Quirks &Quirks::change(char const *quirk, bool set) throw(UnknownQuirkError)
 {
-	find_quirk(quirk) = set;
+	__atomic_store_n(&find_quirk(quirk), set, __ATOMIC_RELAXED);
+	return *this;
+}
+
+std::string Quirks::to_string() const
+{
+	std::string	res;
+
+	if (broken_repeat)
+		res += "broken_repeat";
+
+	if (soft_repeat)
+		res += res.empty() ? "soft_repeat" : ",soft_repeat";
+
+	return res.empty() ? "-" : res;
+}
+
+Quirks &Quirks::parse(char const *quirks) throw(UnknownQuirkError)
+{
+	std::string	tmp(quirks);
+	size_t		pos = 0;
+
+	*this = Quirks();
+
+	if (tmp == "-")
+		return *this;
+
+	while (pos <= tmp.size()) {
+		size_t	end = tmp.find(',', pos);
+
+		if (end == std::string::npos)
+			end = tmp.size();
+
+		if (end > pos)
+			set(tmp.substr(pos, end - pos).c_str());
+
+		pos = end + 1;
+	}
+
 	return *this;
 }
@@ -18,6 +18,7 @@
 #define H_ENSC_VDR_INPUTDEV_QUIRKS_H
 
 #include <stdexcept>
+#include <string>
 
 class Quirks {
 public:	
@@ -29,9 +30,22 @@ public:
 	};
 
 	bool	broken_repeat;
+	// kernel autorepeat is disabled and repeats are generated by the
+	// plugin
+	bool	soft_repeat;
 
 	Quirks();
 
+	// change() can be called while the event loop of the device reads
+	// the flags; use these accessors there
+	bool	has_broken_repeat() const {
+		return __atomic_load_n(&broken_repeat, __ATOMIC_RELAXED);
+	}
+
+	bool	has_soft_repeat() const {
+		return __atomic_load_n(&soft_repeat, __ATOMIC_RELAXED);
+	}
+
 	Quirks	&change(char const *quirk, bool set) throw(UnknownQuirkError);
 
 	Quirks	&set(char const *quirk) throw(UnknownQuirkError) {
@@ -42,6 +56,10 @@ public:
 		return change(quirk, false);
 	}
 
+	// comma separated list of the enabled quirks; '-' when none is set
+	std::string	to_string() const;
+	Quirks	&parse(char const *quirks) throw(UnknownQuirkError);
+
 private:
 	bool	&find_quirk(char const *quirk) throw(UnknownQuirkError);
 };
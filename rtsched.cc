@@ -0,0 +1,197 @@
+/*	--*- c++ -*--
+ * Copyright (C) 2014 Enrico Scholz <ensc@ensc.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 and/or 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rtsched.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vdr/tools.h>
+
+static struct {
+	int		policy;
+	char const	*name;
+} const		POLICIES[] = {
+	{ SCHED_OTHER,	"other" },
+	{ SCHED_FIFO,	"fifo" },
+	{ SCHED_RR,	"rr" },
+};
+
+static char const *get_policy_name(int policy)
+{
+	for (size_t i = 0; i < sizeof POLICIES / sizeof POLICIES[0]; ++i) {
+		if (POLICIES[i].policy == policy)
+			return POLICIES[i].name;
+	}
+
+	return "?";
+}
+
+static std::string format_cpus(cpu_set_t const &cpus)
+{
+	std::string	res;
+	char		buf[32];
+
+	for (int i = 0; i < CPU_SETSIZE; ++i) {
+		int	end = i;
+
+		if (!CPU_ISSET(i, &cpus))
+			continue;
+
+		while (end + 1 < CPU_SETSIZE && CPU_ISSET(end + 1, &cpus))
+			++end;
+
+		if (end == i)
+			snprintf(buf, sizeof buf, "%s%d", res.empty() ? "" : ",", i);
+		else
+			snprintf(buf, sizeof buf, "%s%d-%d",
+				 res.empty() ? "" : ",", i, end);
+
+		res += buf;
+		i = end;
+	}
+
+	return res;
+}
+
+ThreadScheduling::ThreadScheduling() :
+	policy_(SCHED_OTHER), priority_(10), has_cpus_(false)
+{
+	CPU_ZERO(&cpus_);
+}
+
+bool ThreadScheduling::set_policy(char const *name)
+{
+	for (size_t i = 0; i < sizeof POLICIES / sizeof POLICIES[0]; ++i) {
+		if (strcasecmp(POLICIES[i].name, name) == 0) {
+			policy_ = POLICIES[i].policy;
+			return true;
+		}
+	}
+
+	esyslog("invalid scheduling policy '%s'", name);
+	return false;
+}
+
+bool ThreadScheduling::set_priority(char const *prio)
+{
+	char	*end;
+	long	v;
+
+	errno = 0;
+	v = strtol(prio, &end, 10);
+
+	// the range of SCHED_FIFO and SCHED_RR on Linux
+	if (errno != 0 || end == prio || *end != '\0' || v < 1 || v > 99) {
+		esyslog("invalid realtime priority '%s'", prio);
+		return false;
+	}
+
+	priority_ = v;
+	return true;
+}
+
+bool ThreadScheduling::set_cpus(char const *cpus)
+{
+	char const	*p = cpus;
+
+	CPU_ZERO(&cpus_);
+
+	for (;;) {
+		char		*end;
+		unsigned long	first;
+		unsigned long	last;
+
+		errno = 0;
+		first = strtoul(p, &end, 10);
+		if (errno != 0 || end == p)
+			goto err;
+
+		last = first;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtoul(p, &end, 10);
+			if (errno != 0 || end == p || last < first)
+				goto err;
+		}
+
+		if (last >= CPU_SETSIZE)
+			goto err;
+
+		for (unsigned long i = first; i <= last; ++i)
+			CPU_SET(i, &cpus_);
+
+		if (*end == '\0')
+			break;
+
+		if (*end != ',')
+			goto err;
+
+		p = end + 1;
+	}
+
+	has_cpus_ = true;
+	return true;
+
+err:
+	esyslog("invalid cpu list '%s'", cpus);
+	return false;
+}
+
+void ThreadScheduling::apply(char const *prefix, char const *thread) const
+{
+	struct sched_param	param = { };
+	cpu_set_t		cpus;
+	int			policy;
+	int			rc;
+
+	if (policy_ != SCHED_OTHER) {
+		param.sched_priority = priority_;
+
+		rc = pthread_setschedparam(pthread_self(), policy_, &param);
+		if (rc == EPERM)
+			isyslog("%s: %s: no permission for realtime scheduling; CAP_SYS_NICE or RLIMIT_RTPRIO required\n",
+				prefix, thread);
+		else if (rc != 0)
+			esyslog("%s: %s: failed to set scheduling policy: %s\n",
+				prefix, thread, strerror(rc));
+	}
+
+	if (has_cpus_) {
+		rc = pthread_setaffinity_np(pthread_self(), sizeof cpus_, &cpus_);
+		if (rc != 0)
+			esyslog("%s: %s: failed to set cpu affinity: %s\n",
+				prefix, thread, strerror(rc));
+	}
+
+	if (policy_ == SCHED_OTHER && !has_cpus_)
+		// nothing has been changed; avoid noise in the log
+		return;
+
+	if (pthread_getschedparam(pthread_self(), &policy, &param) != 0) {
+		policy = -1;
+		param.sched_priority = 0;
+	}
+
+	CPU_ZERO(&cpus);
+	pthread_getaffinity_np(pthread_self(), sizeof cpus, &cpus);
+
+	isyslog("%s: %s runs with policy %s/%d on cpus %s\n", prefix, thread,
+		get_policy_name(policy), param.sched_priority,
+		format_cpus(cpus).c_str());
+}
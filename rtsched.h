@@ -0,0 +1,46 @@
+/*	--*- c++ -*--
+ * Copyright (C) 2014 Enrico Scholz <ensc@ensc.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 and/or 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_VDR_INPUTDEV_RTSCHED_H
+#define H_ENSC_VDR_INPUTDEV_RTSCHED_H
+
+#include <sched.h>
+
+// Scheduling policy and CPU affinity of the latency critical threads (event
+// loops and key delivery).  Threads call apply() when they start; missing
+// privileges make them fall back to the normal policy.
+class ThreadScheduling {
+public:
+	ThreadScheduling();
+
+	// 'other', 'fifo' or 'rr'
+	bool		set_policy(char const *name);
+	bool		set_priority(char const *prio);
+	// comma separated list of cpus and ranges like '0,2-3'
+	bool		set_cpus(char const *cpus);
+
+	// applies the settings to the calling thread and logs the effective
+	// ones; 'prefix' and 'thread' are used for the log messages
+	void		apply(char const *prefix, char const *thread) const;
+
+private:
+	int		policy_;
+	int		priority_;
+	cpu_set_t	cpus_;
+	bool		has_cpus_;
+};
+
+#endif	/* H_ENSC_VDR_INPUTDEV_RTSCHED_H */
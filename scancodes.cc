@@ -0,0 +1,199 @@
+/*	--*- c++ -*--
+ * Copyright (C) 2014 Enrico Scholz <ensc@ensc.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 and/or 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "scancodes.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <vdr/tools.h>
+
+#include "modmap.h"
+
+bool ScancodeMap::load(void)
+{
+	FILE		*f = fopen(fname_.c_str(), "r");
+	cReadLine	r;
+
+	if (!f) {
+		esyslog("failed to open scancode map '%s': %s",
+			fname_.c_str(), strerror(errno));
+		return false;
+	}
+
+	entries_.clear();
+
+	for (size_t line_num = 1;; ++line_num) {
+		static char const		DELIMS[] = " \t";
+		char				*buf = r.Read(f);
+		char				*buf_next;
+		char				*comment;
+		char const			*scancode;
+		char				*name;
+		char				*end;
+		unsigned long			v;
+		int				code;
+		struct input_keymap_entry	e = { };
+		uint32_t			sc;
+
+		if (!buf)
+			break;
+
+		comment = strchr(buf, '#');
+		if (comment)
+			*comment = '\0';
+
+		scancode = strtok_r(buf, DELIMS, &buf_next);
+		if (!scancode)
+			continue;
+
+		name = strtok_r(NULL, DELIMS, &buf_next);
+
+		errno = 0;
+		v = strtoul(scancode, &end, 0);
+		if (!name || errno != 0 || *end != '\0' || v > 0xfffffffful) {
+			esyslog("%s:%zu invalid entry", fname_.c_str(),
+				line_num);
+			continue;
+		}
+
+		// 'KEY_FOO' and 'foo' are both accepted by 'keymap'
+		for (char *p = name; *p; ++p)
+			*p = tolower((unsigned char)(*p));
+
+		if (strncmp(name, "key_", 4) == 0)
+			name += 4;
+
+		code = ModifierMap::find_keycode(name);
+		if (code < 0) {
+			esyslog("%s:%zu unknown key '%s'", fname_.c_str(),
+				line_num, name);
+			continue;
+		}
+
+		sc = v;
+
+		e.len     = sizeof sc;
+		e.keycode = code;
+		memcpy(e.scancode, &sc, sizeof sc);
+
+		entries_.push_back(e);
+	}
+
+	fclose(f);
+
+	return true;
+}
+
+unsigned int ScancodeMap::apply(int fd) const
+{
+	unsigned int	num_failed = 0;
+
+	for (size_t i = 0; i < entries_.size(); ++i) {
+		if (ioctl(fd, EVIOCSKEYCODE_V2, &entries_[i]) < 0)
+			++num_failed;
+	}
+
+	return num_failed;
+}
+
+ScancodeMapSet::~ScancodeMapSet()
+{
+	for (size_t i = 0; i < maps_.size(); ++i)
+		delete maps_[i];
+}
+
+bool ScancodeMapSet::add(char const *spec)
+{
+	std::string	tmp(spec);
+	size_t		sep = tmp.find('=');
+	std::string	match;
+	std::string	fname;
+	rule		r;
+
+	if (sep == std::string::npos) {
+		esyslog("scancode map '%s' without file", spec);
+		return false;
+	}
+
+	match = tmp.substr(0, sep);
+	fname = tmp.substr(sep + 1);
+
+	r.vendor  = 0;
+	r.product = 0;
+	r.map     = NULL;
+
+	if (match.compare(0, 5, "name:") == 0) {
+		r.by_name = true;
+		r.pattern = match.substr(5);
+	} else {
+		unsigned int	vendor;
+		unsigned int	product;
+		char		c;
+
+		if (sscanf(match.c_str(), "%x:%x%c", &vendor, &product, &c) != 2 ||
+		    vendor > 0xffff || product > 0xffff) {
+			esyslog("scancode map '%s' with invalid device", spec);
+			return false;
+		}
+
+		r.by_name = false;
+		r.vendor  = vendor;
+		r.product = product;
+	}
+
+	// files which are used by multiple rules are loaded only once
+	for (size_t i = 0; i < maps_.size() && !r.map; ++i) {
+		if (fname == maps_[i]->get_fname())
+			r.map = maps_[i];
+	}
+
+	if (!r.map) {
+		ScancodeMap	*map = new ScancodeMap(fname.c_str());
+
+		if (!map->load()) {
+			delete map;
+			return false;
+		}
+
+		maps_.push_back(map);
+		r.map = map;
+	}
+
+	rules_.push_back(r);
+	return true;
+}
+
+ScancodeMap const *ScancodeMapSet::find(struct input_id const &id,
+					char const *name) const
+{
+	for (size_t i = 0; i < rules_.size(); ++i) {
+		rule const	&r = rules_[i];
+
+		if (r.by_name && fnmatch(r.pattern.c_str(), name, 0) == 0)
+			return r.map;
+
+		if (!r.by_name && r.vendor == id.vendor &&
+		    r.product == id.product)
+			return r.map;
+	}
+
+	return NULL;
+}
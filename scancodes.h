@@ -0,0 +1,80 @@
+/*	--*- c++ -*--
+ * Copyright (C) 2014 Enrico Scholz <ensc@ensc.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 and/or 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_VDR_INPUTDEV_SCANCODES_H
+#define H_ENSC_VDR_INPUTDEV_SCANCODES_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <linux/input.h>
+
+// Scancode to keycode table in the format of the udev 'keymap' program
+// ('<scancode> <key>' lines; see contrib/).  The entries are kept in the
+// form which is passed to EVIOCSKEYCODE_V2.
+class ScancodeMap {
+public:
+	explicit ScancodeMap(char const *fname) : fname_(fname) {}
+
+	bool		load(void);
+
+	char const	*get_fname(void) const { return fname_.c_str(); }
+	size_t		size(void) const { return entries_.size(); }
+
+	// programs the table into the device; returns the number of entries
+	// which were rejected
+	unsigned int	apply(int fd) const;
+
+private:
+	std::string				fname_;
+	std::vector<struct input_keymap_entry>	entries_;
+};
+
+// Assignment of scancode maps to devices.  Maps are loaded when they are
+// added; the set must not be modified while devices use it.
+class ScancodeMapSet {
+public:
+	ScancodeMapSet() {}
+	~ScancodeMapSet();
+
+	// '<vendor>:<product>=<file>' with hexadecimal ids or
+	// 'name:<pattern>=<file>' with a fnmatch(3) pattern for the device
+	// name
+	bool		add(char const *spec);
+
+	bool		empty(void) const { return rules_.empty(); }
+
+	// returns the map of the first matching rule
+	ScancodeMap const	*find(struct input_id const &id,
+				      char const *name) const;
+
+private:
+	struct rule {
+		bool		by_name;
+		uint16_t	vendor;
+		uint16_t	product;
+		std::string	pattern;
+		ScancodeMap	*map;
+	};
+
+	std::vector<rule>		rules_;
+	std::vector<ScancodeMap *>	maps_;
+
+	ScancodeMapSet(ScancodeMapSet const &);
+	ScancodeMapSet &operator = (ScancodeMapSet const &);
+};
+
+#endif	/* H_ENSC_VDR_INPUTDEV_SCANCODES_H */
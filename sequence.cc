@@ -0,0 +1,260 @@
+/*	--*- c++ -*--
+ * Copyright (C) 2014 Enrico Scholz <ensc@ensc.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 and/or 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sequence.h"
+
+#include <string.h>
+#include <deque>
+#include <string>
+#include <vdr/tools.h>
+
+#include "modmap.h"
+#include "util.h"
+
+static struct {
+	enum SequenceMatcher::action	act;
+	char const			*name;
+} const		ACTIONS[] = {
+	{ SequenceMatcher::acDETACH,		"detach" },
+	{ SequenceMatcher::acREATTACH,		"reattach" },
+	{ SequenceMatcher::acRELOAD_MODMAP,	"reload" },
+	{ SequenceMatcher::acDUMP_STATS,	"stats" },
+};
+
+static unsigned int const	RIGHT_MODIFIERS[] = {
+	KEY_RIGHTSHIFT, KEY_RIGHTCTRL, KEY_RIGHTALT, KEY_RIGHTMETA,
+};
+
+char const *SequenceMatcher::get_action_name(enum action act)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(ACTIONS); ++i) {
+		if (ACTIONS[i].act == act)
+			return ACTIONS[i].name;
+	}
+
+	return "none";
+}
+
+unsigned int SequenceMatcher::get_alias(unsigned int code)
+{
+	switch (code) {
+	case KEY_RIGHTSHIFT:	return KEY_LEFTSHIFT;
+	case KEY_RIGHTCTRL:	return KEY_LEFTCTRL;
+	case KEY_RIGHTALT:	return KEY_LEFTALT;
+	case KEY_RIGHTMETA:	return KEY_LEFTMETA;
+	default:		return code;
+	}
+}
+
+bool SequenceMatcher::add(char const *spec)
+{
+	std::string	tmp(spec);
+	size_t		sep = tmp.rfind('=');
+	size_t		pos = 0;
+	sequence	seq;
+	std::string	act;
+
+	if (sep == std::string::npos) {
+		esyslog("hotkey '%s' without action", spec);
+		return false;
+	}
+
+	act = tmp.substr(sep + 1);
+	seq.act = acNONE;
+	seq.spec = spec;
+
+	for (size_t i = 0; i < ARRAY_SIZE(ACTIONS); ++i) {
+		if (strcasecmp(act.c_str(), ACTIONS[i].name) == 0)
+			seq.act = ACTIONS[i].act;
+	}
+
+	if (seq.act == acNONE) {
+		esyslog("hotkey '%s' with unknown action '%s'", spec,
+			act.c_str());
+		return false;
+	}
+
+	while (pos < sep) {
+		size_t		end = tmp.find(',', pos);
+		std::string	name;
+		int		code;
+
+		if (end == std::string::npos || end > sep)
+			end = sep;
+
+		name = tmp.substr(pos, end - pos);
+		code = ModifierMap::find_keycode(name.c_str());
+		if (code < 0) {
+			esyslog("hotkey '%s' with unknown key '%s'", spec,
+				name.c_str());
+			return false;
+		}
+
+		seq.keys.push_back(code);
+		pos = end + 1;
+	}
+
+	if (seq.keys.empty()) {
+		esyslog("hotkey '%s' without keys", spec);
+		return false;
+	}
+
+	sequences_.push_back(seq);
+	return true;
+}
+
+bool SequenceMatcher::can_match(unsigned long const key_bits[]) const
+{
+	for (size_t i = 0; i < sequences_.size(); ++i) {
+		std::vector<uint16_t> const	&keys = sequences_[i].keys;
+		bool				is_ok = true;
+
+		for (size_t j = 0; j < keys.size() && is_ok; ++j) {
+			unsigned int	code = keys[j];
+
+			is_ok = test_bit(code, key_bits);
+
+			// a left modifier might be produced by the right one
+			for (size_t k = 0; !is_ok && k < ARRAY_SIZE(RIGHT_MODIFIERS); ++k) {
+				if (get_alias(RIGHT_MODIFIERS[k]) == code)
+					is_ok = test_bit(RIGHT_MODIFIERS[k],
+							 key_bits);
+			}
+		}
+
+		if (is_ok)
+			return true;
+	}
+
+	return false;
+}
+
+bool SequenceMatcher::compile(void)
+{
+	// trie of the sequences; -1 marks missing edges
+	std::vector<int>		trie;
+	std::vector<unsigned int>	fail;
+	std::deque<unsigned int>	queue;
+	size_t				num_nodes = 1;
+	bool				is_ok = true;
+
+	memset(symbols_, 0, sizeof symbols_);
+	num_symbols_ = 1;
+
+	for (size_t i = 0; i < sequences_.size(); ++i) {
+		std::vector<uint16_t> const	&keys = sequences_[i].keys;
+
+		for (size_t j = 0; j < keys.size(); ++j) {
+			if (symbols_[keys[j]] == 0 && num_symbols_ < 256)
+				symbols_[keys[j]] = num_symbols_++;
+		}
+	}
+
+	for (unsigned int code = 0; code < KEY_CNT; ++code) {
+		unsigned int	alias = get_alias(code);
+
+		if (symbols_[code] == 0 && alias != code)
+			symbols_[code] = symbols_[alias];
+	}
+
+	trie.assign(num_symbols_, -1);
+	actions_.assign(1, acNONE);
+
+	for (size_t i = 0; i < sequences_.size(); ++i) {
+		std::vector<uint16_t> const	&keys = sequences_[i].keys;
+		unsigned int			node = 0;
+
+		for (size_t j = 0; j < keys.size(); ++j) {
+			unsigned int	sym = symbols_[keys[j]];
+
+			if (sym == 0) {
+				// more than 255 different keys
+				node = 0;
+				break;
+			}
+
+			if (trie[node * num_symbols_ + sym] < 0) {
+				trie[node * num_symbols_ + sym] = num_nodes++;
+				trie.resize(num_nodes * num_symbols_, -1);
+				actions_.push_back(acNONE);
+			}
+
+			node = trie[node * num_symbols_ + sym];
+		}
+
+		if (node != 0 && actions_[node] == acNONE) {
+			actions_[node] = sequences_[i].act;
+		} else if (node != 0) {
+			esyslog("hotkey '%s' is defined twice",
+				sequences_[i].spec.c_str());
+			is_ok = false;
+		}
+	}
+
+	// Aho-Corasick construction; missing edges are resolved through the
+	// failure links so that a partial match can continue with a suffix
+	// of it
+	next_.assign(num_nodes * num_symbols_, 0);
+	fail.assign(num_nodes, 0);
+	queue.push_back(0);
+
+	while (!queue.empty()) {
+		unsigned int	node = queue.front();
+
+		queue.pop_front();
+
+		for (unsigned int sym = 0; sym < num_symbols_; ++sym) {
+			int		child = trie[node * num_symbols_ + sym];
+			unsigned int	idx = node * num_symbols_ + sym;
+
+			if (child < 0) {
+				next_[idx] = node == 0 ? 0 :
+					next_[fail[node] * num_symbols_ + sym];
+				continue;
+			}
+
+			fail[child] = node == 0 ? 0 :
+				next_[fail[node] * num_symbols_ + sym];
+
+			if (actions_[child] == acNONE)
+				actions_[child] = actions_[fail[child]];
+
+			next_[idx] = child;
+			queue.push_back(child);
+		}
+	}
+
+	// a node which completes a sequence resets the matcher; the paths
+	// of longer sequences through it are dead
+	for (size_t i = 0; i < sequences_.size(); ++i) {
+		std::vector<uint16_t> const	&keys = sequences_[i].keys;
+		unsigned int			node = 0;
+
+		for (size_t j = 0; j + 1 < keys.size(); ++j) {
+			node = next_[node * num_symbols_ + symbols_[keys[j]]];
+
+			if (actions_[node] != acNONE) {
+				esyslog("hotkey '%s' can never match; a part of it completes the '%s' hotkey",
+					sequences_[i].spec.c_str(),
+					get_action_name(static_cast<enum action>(actions_[node])));
+				is_ok = false;
+				break;
+			}
+		}
+	}
+
+	return is_ok;
+}
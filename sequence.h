@@ -0,0 +1,119 @@
+/*	--*- c++ -*--
+ * Copyright (C) 2014 Enrico Scholz <ensc@ensc.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 and/or 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_VDR_INPUTDEV_SEQUENCE_H
+#define H_ENSC_VDR_INPUTDEV_SEQUENCE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <linux/input.h>
+
+// Set of key sequences (hotkeys) which are bound to actions.  All sequences
+// are compiled into one DFA over the keys used by them; matching costs one
+// table step per key press.  Right modifiers are treated like the left ones
+// unless a sequence uses them explicitly.
+//
+// The object must not be modified after compile() while devices use it.
+class SequenceMatcher {
+public:
+	enum action {
+		acNONE,
+		acDETACH,		// detach the device
+		acREATTACH,		// add all devices from the coldplug dir
+		acRELOAD_MODMAP,
+		acDUMP_STATS,
+	};
+
+	// matching state of a single device
+	struct State {
+		unsigned int	node;
+		struct timeval	last;	// time of the last key press
+
+		State() : node(0) {}
+	};
+
+	SequenceMatcher() : num_symbols_(1) {}
+
+	// '<key>,<key>,...=<action>' with key names like in the modmap file
+	// and 'detach', 'reattach', 'reload' or 'stats' as action
+	bool		add(char const *spec);
+
+	// fails when a sequence contains another one (e.g. as a prefix); the
+	// shorter one would always complete first so that the longer one
+	// could never match
+	bool		compile(void);
+
+	bool		empty(void) const { return sequences_.empty(); }
+
+	// checks whether a device with the given EV_KEY capabilities can
+	// produce at least one of the sequences
+	bool		can_match(unsigned long const key_bits[]) const;
+
+	// feeds an event into the matcher; returns the action of a completed
+	// sequence
+	enum action	step(State &st, struct input_event const &ev) const {
+		unsigned int	node = st.node;
+		enum action	act;
+
+		if (ev.type != EV_KEY || ev.value != 1 || ev.code >= KEY_CNT)
+			// only key presses are used
+			return acNONE;
+
+		if (node != 0 && is_timed_out(st.last, ev.time))
+			node = 0;
+
+		node = next_[node * num_symbols_ + symbols_[ev.code]];
+		act  = static_cast<enum action>(actions_[node]);
+
+		st.node = act == acNONE ? node : 0;
+		st.last = ev.time;
+
+		return act;
+	}
+
+	static char const	*get_action_name(enum action act);
+
+private:
+	struct sequence {
+		std::string		spec;
+		std::vector<uint16_t>	keys;
+		enum action		act;
+	};
+
+	std::vector<sequence>	sequences_;
+
+	// compact symbol of every key code; 0 for keys which are not used in
+	// any sequence
+	uint8_t			symbols_[KEY_CNT];
+	unsigned int		num_symbols_;
+
+	// transition table with 'num_symbols_' entries per node and the
+	// action which is completed by reaching a node
+	std::vector<uint16_t>	next_;
+	std::vector<uint8_t>	actions_;
+
+	static bool	is_timed_out(struct timeval const &last,
+				     struct timeval const &now) {
+		// a sequence must be completed within 2.5s
+		return ((int64_t)(now.tv_sec - last.tv_sec) * 1000000 +
+			now.tv_usec - last.tv_usec) > 2500000;
+	}
+
+	static unsigned int	get_alias(unsigned int code);
+};
+
+#endif	/* H_ENSC_VDR_INPUTDEV_SEQUENCE_H */
@@ -0,0 +1,89 @@
+/*	--*- c++ -*--
+ * Copyright (C) 2014 Enrico Scholz <ensc@ensc.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 and/or 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_VDR_INPUTDEV_STATS_H
+#define H_ENSC_VDR_INPUTDEV_STATS_H
+
+#include <stdint.h>
+
+#include "histogram.h"
+
+// Statistics of a single device.  Object is reference counted because
+// queued keys can outlive the device.
+//
+// Counters are written by the event loop or the key delivery thread and
+// read by SVDRP; relaxed atomics are sufficient because they are
+// independent of each other.
+class DeviceStats {
+public:
+	enum counter {
+		cntEVENTS,		// input_events read from the device
+		cntBYTES,		// bytes read from the device
+		cntKEYS,		// keys delivered to vdr
+		cntSUPPRESSED,		// keys dropped by the key filter
+		cntPUT_FAILED,		// keys rejected by cRemote::Put()
+		cntSYN_DROPPED,		// SYN_DROPPED events
+		cntCOALESCED,		// repeats dropped while vdr was busy
+
+		_cntMAX
+	};
+
+	LatencyHistogram	latency;
+
+	DeviceStats() : last_event_us_(0), refcnt_(1) {
+		for (size_t i = 0; i < _cntMAX; ++i)
+			counters_[i] = 0;
+	}
+
+	void		add(enum counter c, unsigned long v = 1) {
+		__atomic_fetch_add(&counters_[c], v, __ATOMIC_RELAXED);
+	}
+
+	unsigned long	get(enum counter c) const {
+		return __atomic_load_n(&counters_[c], __ATOMIC_RELAXED);
+	}
+
+	// CLOCK_MONOTONIC timestamp in microseconds
+	void		set_last_event(int64_t us) {
+		__atomic_store_n(&last_event_us_, us, __ATOMIC_RELAXED);
+	}
+
+	int64_t		get_last_event(void) const {
+		return __atomic_load_n(&last_event_us_, __ATOMIC_RELAXED);
+	}
+
+	DeviceStats	*ref(void) {
+		__atomic_fetch_add(&refcnt_, 1, __ATOMIC_RELAXED);
+		return this;
+	}
+
+	void		unref(void) {
+		if (__atomic_sub_fetch(&refcnt_, 1, __ATOMIC_ACQ_REL) == 0)
+			delete this;
+	}
+
+private:
+	unsigned long	counters_[_cntMAX];
+	int64_t		last_event_us_;
+	unsigned int	refcnt_;
+
+	~DeviceStats() {}
+
+	DeviceStats(DeviceStats const &);
+	DeviceStats &operator = (DeviceStats const &);
+};
+
+#endif	/* H_ENSC_VDR_INPUTDEV_STATS_H */
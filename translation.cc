@@ -0,0 +1,101 @@
+/*	--*- c++ -*--
+ * Copyright (C) 2014 Enrico Scholz <ensc@ensc.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 and/or 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "translation.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+TranslationTable::TranslationTable()
+{
+	memset(table_, 0, sizeof table_);
+}
+
+unsigned long TranslationTable::get_modifier_mask(unsigned int code)
+{
+	unsigned long	mask = 0;
+
+	switch (code) {
+	case KEY_LEFTSHIFT:
+	case KEY_RIGHTSHIFT:
+		set_bit(ModifierMap::modSHIFT, &mask);
+		break;
+
+	case KEY_LEFTCTRL:
+	case KEY_RIGHTCTRL:
+		set_bit(ModifierMap::modCONTROL, &mask);
+		break;
+
+	case KEY_LEFTALT:
+	case KEY_RIGHTALT:
+		set_bit(ModifierMap::modALT, &mask);
+		break;
+
+	case KEY_LEFTMETA:
+	case KEY_RIGHTMETA:
+		set_bit(ModifierMap::modMETA, &mask);
+		break;
+
+	case KEY_NUMLOCK:
+		set_bit(ModifierMap::modNUMLOCK, &mask);
+		break;
+
+	default:
+		break;
+	}
+
+	return mask;
+}
+
+void TranslationTable::compile(ModifierMap const &modmap,
+			       enum eKeys const keys[KEY_CNT])
+{
+	for (size_t kt = 0; kt < ARRAY_SIZE(table_); ++kt) {
+		for (unsigned int code = 0; code < KEY_CNT; ++code) {
+			unsigned long	mask = get_modifier_mask(code);
+			wchar_t		c;
+			entry_t		e;
+
+			c = modmap.get_char(static_cast<enum ModifierMap::keytable>(kt),
+					    code);
+
+			if (mask != 0)
+				e = make_entry(acMODIFIER, mask);
+			else if (c != L'\0')
+				e = make_entry(acRAW, c);
+			else if (keys[code] != kNone)
+				e = make_entry(acKEY, keys[code]);
+			else
+				e = make_entry(acCODE, 0);
+
+			table_[kt][code] = e;
+		}
+	}
+}
+
+SharedModmap::SharedModmap(char const *fname) :
+	refcnt(0), next(NULL), fname_(fname ? strdup(fname) : NULL),
+	table_(NULL)
+{
+}
+
+SharedModmap::~SharedModmap()
+{
+	delete table_;
+	free(fname_);
+}
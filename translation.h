@@ -0,0 +1,101 @@
+/*	--*- c++ -*--
+ * Copyright (C) 2014 Enrico Scholz <ensc@ensc.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 and/or 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_VDR_INPUTDEV_TRANSLATION_H
+#define H_ENSC_VDR_INPUTDEV_TRANSLATION_H
+
+#include <stdint.h>
+#include <linux/input.h>
+#include <vdr/keys.h>
+
+#include "epoch.h"
+#include "modmap.h"
+
+// Precompiled translation of EV_KEY codes.  The table is indexed by the
+// reduced modifier state (see ModifierMap::get_keytable()) and the key
+// code and yields the final action for the key.
+class TranslationTable : public EpochObject {
+public:
+	enum action {
+		acCODE,		// no mapping; generate a code for cRemote
+		acMODIFIER,	// modifier key; value is the modifier mask
+		acRAW,		// keyboard key; value is the character
+		acKEY,		// vdr key; value is a 'enum eKeys'
+	};
+
+	typedef uint32_t	entry_t;
+
+	TranslationTable();
+
+	void		compile(ModifierMap const &modmap,
+				enum eKeys const keys[KEY_CNT]);
+
+	entry_t		lookup(enum ModifierMap::keytable kt,
+			       unsigned int code) const {
+		return code < KEY_CNT ? table_[kt][code] : 0;
+	}
+
+	static enum action	get_action(entry_t e) {
+		return static_cast<enum action>(e >> 24);
+	}
+
+	static uint32_t		get_value(entry_t e) {
+		return e & 0xffffffu;
+	}
+
+	static unsigned long	get_modifier_mask(unsigned int code);
+
+private:
+	entry_t		table_[ModifierMap::_ktMAX][KEY_CNT];
+
+	static entry_t		make_entry(enum action a, uint32_t v) {
+		return (static_cast<entry_t>(a) << 24) | (v & 0xffffffu);
+	}
+};
+
+// A modmap file together with its compiled translation table.  Objects are
+// shared by all devices which use the same modmap file; the table is
+// replaced atomically when the file is reloaded.
+class SharedModmap : public EpochObject {
+public:
+	explicit SharedModmap(char const *fname);
+	virtual ~SharedModmap();
+
+	char const		*get_fname(void) const { return fname_; }
+
+	TranslationTable const	*get_table(void) const {
+		return __atomic_load_n(&table_, __ATOMIC_ACQUIRE);
+	}
+
+	// returns the previous table which must be retired by the caller
+	TranslationTable	*replace_table(TranslationTable *table) {
+		return __atomic_exchange_n(&table_, table, __ATOMIC_ACQ_REL);
+	}
+
+	// reference counter and link in the list of loaded modmaps; both are
+	// managed by the controller
+	unsigned int		refcnt;
+	SharedModmap		*next;
+
+private:
+	char			*fname_;
+	TranslationTable	*table_;
+
+	SharedModmap(SharedModmap const &);
+	SharedModmap &operator = (SharedModmap const &);
+};
+
+#endif	/* H_ENSC_VDR_INPUTDEV_TRANSLATION_H */
@@ -19,11 +19,101 @@
 #include <string.h>
 #include <sysexits.h>
 #include <unistd.h>
-#include <alloca.h>
+#include <getopt.h>
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
+/* must not exceed the receive buffer of the plugin ('--recv-buffer') */
+#define MAX_DGRAM_SIZE	4096
+
+struct batch {
+	int				fd;
+	struct sockaddr_un const	*addr;
+	/* one extra byte for the NUL written by snprintf() */
+	char				buf[MAX_DGRAM_SIZE + 1];
+	size_t				len;
+};
+
+static int flush_batch(struct batch *b)
+{
+	ssize_t			l;
+
+	if (b->len == 0)
+		return EX_OK;
+
+	l = sendto(b->fd, b->buf, b->len, 0, (void *)b->addr, sizeof *b->addr);
+	if (l < 0) {
+		perror("sendto()");
+		return EX_OSERR;
+	}
+
+	if ((size_t)l != b->len) {
+		fprintf(stderr, "not all data sent\n");
+		return EX_OSERR;
+	}
+
+	b->len = 0;
+	return EX_OK;
+}
+
+/* appends 'action dev\n' to the batch; sends the pending commands first
+ * when the datagram would become too large */
+static int queue_cmd(struct batch *b, char const *prefix, char const *action,
+		     char const *dev)
+{
+	size_t		l = strlen(prefix) + strlen(action) + strlen(dev) + 2;
+	int		rc;
+
+	if (strncmp(dev, "/dev/", 5) == 0)
+		dev += 5;
+
+	if (strncmp(dev, "input/", 6) == 0)
+		dev += 6;
+
+	if (l > MAX_DGRAM_SIZE) {
+		fprintf(stderr, "command for '%s' too long\n", dev);
+		return EX_USAGE;
+	}
+
+	if (b->len + l > MAX_DGRAM_SIZE) {
+		rc = flush_batch(b);
+		if (rc != EX_OK)
+			return rc;
+	}
+
+	b->len += snprintf(b->buf + b->len, sizeof b->buf - b->len,
+			   "%s%s %s\n", prefix, action, dev);
+	return EX_OK;
+}
+
+static int queue_dev(struct batch *b, char const *action, char const *dev)
+{
+	char const	*modmap = getenv("VDR_INPUTDEV_MODMAP");
+	int		rc = EX_OK;
+
+	/* assign the modmap before adding the device so that it is active
+	 * from the first key on */
+	if (modmap != NULL && modmap[0] != '\0' &&
+	    strcmp(action, "add") == 0)
+		rc = queue_cmd(b, "modmap:", modmap, dev);
+
+	if (rc == EX_OK)
+		rc = queue_cmd(b, "", action, dev);
+
+	return rc;
+}
+
+static void show_help(void)
+{
+	printf("Usage: vdr-inputdev <dev> [<socket>]\n"
+	       "       vdr-inputdev -b [-s <socket>] [-a <action>] [<dev>...]\n"
+	       "\n"
+	       "In batch mode (-b), all devices are sent in as few messages as\n"
+	       "possible; device names are read from stdin when none is given.\n"
+	       "The action defaults to $ACTION or 'add'.\n");
+}
+
 int main(int argc, char *argv[])
 {
 	struct sockaddr_un	addr = {
@@ -31,53 +121,75 @@ int main(int argc, char *argv[])
 		.sun_path	=  SOCKET_PATH,
 	};
 
-	int			fd;
-	char			*cmd;
-	char const		*dev;
+	struct batch		batch = { .addr = &addr };
 	char const		*action = getenv("ACTION");
-	ssize_t			l;
+	char const		*sock_path = NULL;
+	int			is_batch = 0;
+	int			rc = EX_OK;
 
-	if (argc < 2) {
-		fprintf(stderr, "missing device name\n");
-		return EX_USAGE;
-	}
+	for (;;) {
+		int	c = getopt(argc, argv, "bs:a:h");
 
-	if (argc > 2) {
-		strncpy(addr.sun_path, argv[2], sizeof addr.sun_path - 1);
-		/* string is terminated by initial assignment */
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'b':  is_batch = 1; break;
+		case 's':  sock_path = optarg; break;
+		case 'a':  action = optarg; break;
+		case 'h':
+			show_help();
+			return EX_OK;
+		default:
+			return EX_USAGE;
+		}
 	}
 
-	fd = socket(AF_UNIX, SOCK_DGRAM, 0);
-	if (fd < 0) {
-		perror("socket()");
-		return EX_OSERR;
+	if (!is_batch) {
+		/* legacy form: <dev> [<socket>] */
+		if (optind >= argc) {
+			fprintf(stderr, "missing device name\n");
+			return EX_USAGE;
+		}
+
+		if (optind + 1 < argc)
+			sock_path = argv[optind + 1];
 	}
 
-	dev = argv[1];
-	if (strncmp(dev, "input/", 6) == 0)
-		dev += 6;
+	if (sock_path != NULL) {
+		strncpy(addr.sun_path, sock_path, sizeof addr.sun_path - 1);
+		/* string is terminated by initial assignment */
+	}
 
 	if (action == NULL)
 		action = "add";
 
-	cmd = alloca(strlen(action) + sizeof(" \n") + strlen(dev));
-	strcpy(cmd, action);
-	strcat(cmd, " ");
-	strcat(cmd, dev);
-	strcat(cmd, "\n");
-
-	l = sendto(fd, cmd, strlen(cmd), 0, (void *)&addr, sizeof addr);
-	close(fd);
-
-	if (l < 0) {
-		perror("sendto()");
+	batch.fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (batch.fd < 0) {
+		perror("socket()");
 		return EX_OSERR;
 	}
 
-	if ((size_t)l != strlen(cmd)) {
-		fprintf(stderr, "not all data sent\n");
-		return EX_OSERR;
+	if (!is_batch) {
+		rc = queue_dev(&batch, action, argv[optind]);
+	} else if (optind < argc) {
+		for (int i = optind; i < argc && rc == EX_OK; ++i)
+			rc = queue_dev(&batch, action, argv[i]);
+	} else {
+		char	line[256];
+
+		while (rc == EX_OK && fgets(line, sizeof line, stdin)) {
+			line[strcspn(line, "\r\n")] = '\0';
+
+			if (line[0] != '\0')
+				rc = queue_dev(&batch, action, line);
+		}
 	}
 
-	return EX_OK;
+	if (rc == EX_OK)
+		rc = flush_batch(&batch);
+
+	close(batch.fd);
+
+	return rc;
 }
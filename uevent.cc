@@ -0,0 +1,125 @@
+/*	--*- c++ -*--
+ * Copyright (C) 2014 Enrico Scholz <ensc@ensc.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 and/or 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "uevent.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "util.h"
+
+// header of messages sent by udevd; see libudev-monitor.c
+struct udev_monitor_netlink_header {
+	char		prefix[8];
+	uint32_t	magic;
+	uint32_t	header_size;
+	uint32_t	properties_off;
+	uint32_t	properties_len;
+	uint32_t	filter_subsystem_hash;
+	uint32_t	filter_devtype_hash;
+	uint32_t	filter_tag_bloom_hi;
+	uint32_t	filter_tag_bloom_lo;
+};
+
+static uint32_t const	UDEV_MONITOR_MAGIC = 0xfeedcafe;
+
+bool Uevent::parse_props(char const *p, char const *end)
+{
+	num_props_ = 0;
+
+	while (p < end) {
+		size_t	l = strnlen(p, end - p);
+
+		if (p + l == end)
+			// not terminated
+			return false;
+
+		if (l > 0 && strchr(p, '=') != NULL) {
+			if (num_props_ == ARRAY_SIZE(props_))
+				return false;
+
+			props_[num_props_++] = p;
+		}
+
+		p += l + 1;
+	}
+
+	return true;
+}
+
+bool Uevent::parse(void const *buf, size_t len)
+{
+	struct udev_monitor_netlink_header	hdr;
+	char const	*p;
+
+	if (len > sizeof buf_ || len == 0)
+		return false;
+
+	memcpy(buf_, buf, len);
+
+	if (len >= sizeof hdr && memcmp(buf_, "libudev", 8) == 0) {
+		memcpy(&hdr, buf_, sizeof hdr);
+
+		if (ntohl(hdr.magic) != UDEV_MONITOR_MAGIC ||
+		    hdr.properties_off < sizeof hdr ||
+		    hdr.properties_off > len ||
+		    hdr.properties_len > len - hdr.properties_off)
+			return false;
+
+		p = buf_ + hdr.properties_off;
+		return parse_props(p, p + hdr.properties_len);
+	}
+
+	// kernel message: 'ACTION@DEVPATH' followed by the properties
+	p = static_cast<char const *>(memchr(buf_, '\0', len));
+	if (!p || memchr(buf_, '@', p - buf_) == NULL)
+		return false;
+
+	return parse_props(p + 1, buf_ + len);
+}
+
+char const *Uevent::get(char const *key) const
+{
+	size_t		l = strlen(key);
+
+	for (size_t i = 0; i < num_props_; ++i) {
+		if (strncmp(props_[i], key, l) == 0 && props_[i][l] == '=')
+			return props_[i] + l + 1;
+	}
+
+	return NULL;
+}
+
+bool Uevent::has_prefix(char const *key, char const *prefix) const
+{
+	char const	*v = get(key);
+	size_t		l = strlen(prefix);
+
+	while (v && *v) {
+		char const	*end = strchr(v, ' ');
+
+		if (!end)
+			end = v + strlen(v);
+
+		if ((size_t)(end - v) > l && strncmp(v, prefix, l) == 0)
+			return true;
+
+		v = *end ? end + 1 : end;
+	}
+
+	return false;
+}
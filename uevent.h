@@ -0,0 +1,53 @@
+/*	--*- c++ -*--
+ * Copyright (C) 2014 Enrico Scholz <ensc@ensc.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 and/or 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_VDR_INPUTDEV_UEVENT_H
+#define H_ENSC_VDR_INPUTDEV_UEVENT_H
+
+#include <stddef.h>
+
+// Parsed uevent as sent by the kernel (NETLINK_KOBJECT_UEVENT group 1) or
+// by udevd (group 2, with a 'libudev' header).  Properties point into an
+// internal copy of the message.
+class Uevent {
+public:
+	enum {
+		GROUP_KERNEL = 1,
+		GROUP_UDEV   = 2,
+	};
+
+	Uevent() : num_props_(0) {}
+
+	bool		parse(void const *buf, size_t len);
+
+	char const	*get(char const *key) const;
+
+	// checks whether the whitespace separated list in property 'key'
+	// contains an entry which starts with 'prefix'
+	bool		has_prefix(char const *key, char const *prefix) const;
+
+private:
+	char		buf_[8192];
+	char const	*props_[128];
+	size_t		num_props_;
+
+	bool		parse_props(char const *p, char const *end);
+
+	Uevent(Uevent const &);
+	Uevent &operator = (Uevent const &);
+};
+
+#endif	/* H_ENSC_VDR_INPUTDEV_UEVENT_H */
@@ -17,28 +17,32 @@
 #ifndef HH_ENSC_VDR_INPUTDEV_UTIL_HH
 #define HH_ENSC_VDR_INPUTDEV_UTIL_HH
 
+#include <stdint.h>
+
 #define ARRAY_SIZE(_a)	(sizeof(_a) / sizeof(_a)[0])
+#define BITS_TO_LONGS(_n) \
+	(((_n) + sizeof(unsigned long) * 8 - 1) / (sizeof(unsigned long) * 8))
 
 inline static bool test_bit(unsigned int bit, unsigned long const mask[])
 {
 	unsigned long	m = mask[bit / (sizeof mask[0] * 8)];
 	unsigned int	i = bit % (sizeof mask[0] * 8);
 
-	return (m & (1u << i)) != 0u;
+	return (m & (1ul << i)) != 0u;
 }
 
 inline static void set_bit(unsigned int bit, unsigned long mask[])
 {
 	unsigned int	i = bit % (sizeof mask[0] * 8);
 
-	mask[bit / (sizeof mask[0] * 8)] |= (1u << i);
+	mask[bit / (sizeof mask[0] * 8)] |= (1ul << i);
 }
 
 inline static void clear_bit(unsigned int bit, unsigned long mask[])
 {
 	unsigned int	i = bit % (sizeof mask[0] * 8);
 
-	mask[bit / (sizeof mask[0] * 8)] &= ~(1u << i);
+	mask[bit / (sizeof mask[0] * 8)] &= ~(1ul << i);
 }
 
 inline static void change_bit(unsigned int bit, unsigned long mask[])
@@ -49,4 +53,17 @@ inline static void change_bit(unsigned int bit, unsigned long mask[])
 		set_bit(bit, mask);
 }
 
+// FNV-1a hash of a string
+inline static uint32_t fnv1a_hash(char const *str)
+{
+	uint32_t	h = 2166136261u;
+
+	for (; *str; ++str) {
+		h ^= (unsigned char)(*str);
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
 #endif	/* HH_ENSC_VDR_INPUTDEV_UTIL_HH */